@@ -171,6 +171,36 @@ int ae_decrypt( ae_ctx* ctx,
  *
  * ----------------------------------------------------------------------- */
 
+int ae_encrypt_batch( ae_ctx* ctx,
+                      int n,
+                      const void* const* nonces,
+                      void* const* texts,
+                      const int* lens,
+                      int* results );
+int ae_decrypt_batch( ae_ctx* ctx,
+                      int n,
+                      const void* const* nonces,
+                      void* const* texts,
+                      const int* lens,
+                      int* results );
+/* --------------------------------------------------------------------------
+ *
+ * Encrypt or decrypt n messages at once (a Mosh addition), interleaving
+ * their AES work where the implementation can.
+ *
+ * Each texts[i] is 16-byte aligned and is processed in place, without
+ * associated data and with the tag after the text. ae_encrypt_batch()
+ * writes lens[i] bytes of ciphertext and then the tag, and so needs
+ * tag_len bytes of room after each text. ae_decrypt_batch() takes lens[i]
+ * bytes of ciphertext and tag. results[i] receives what ae_encrypt() or
+ * ae_decrypt() with AE_FINALIZE would have returned for that message.
+ *
+ * Returns:
+ *  AE_SUCCESS       - Every message was processed; see results.
+ *  Otherwise        - Error. Check implementation documentation for codes.
+ *
+ * ----------------------------------------------------------------------- */
+
 #ifdef __cplusplus
 } /* closing brace for extern "C" */
 #endif
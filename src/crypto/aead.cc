@@ -0,0 +1,345 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#include "src/include/config.h"
+
+#include <cstring>
+
+#include "src/crypto/ae.h"
+#include "src/crypto/aead.h"
+#include "src/util/fatal_assert.h"
+
+#if USE_OPENSSL_AES
+#include <openssl/evp.h>
+#elif USE_NETTLE_AES
+#if HAVE_DECL_GCM_AES256_ENCRYPT
+#include <nettle/gcm.h>
+#endif
+#if HAVE_DECL_CHACHA_POLY1305_ENCRYPT
+#include <nettle/chacha-poly1305.h>
+#endif
+#endif
+
+using namespace Crypto;
+
+/* AES-128-OCB, as Mosh has always used it */
+class OCBAEAD : public AEAD
+{
+private:
+  AlignedBuffer ctx_buf;
+  ae_ctx* ctx;
+  AlignedBuffer nonce_buffer;
+
+public:
+  OCBAEAD( const unsigned char* key )
+    : ctx_buf( ae_ctx_sizeof() ), ctx( (ae_ctx*)ctx_buf.data() ), nonce_buffer( Nonce::NONCE_LEN )
+  {
+    if ( AE_SUCCESS != ae_init( ctx, key, 16, 12, 16 ) ) {
+      throw CryptoException( "Could not initialize AES-OCB context." );
+    }
+  }
+
+  ~OCBAEAD() { fatal_assert( ae_clear( ctx ) == AE_SUCCESS ); }
+
+  bool encrypt( const Nonce& nonce, char* text, size_t len )
+  {
+    memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
+    return int( len + TAG_LEN )
+           == ae_encrypt( ctx, nonce_buffer.data(), text, len, NULL, 0, text, NULL, AE_FINALIZE );
+  }
+
+  bool decrypt( const Nonce& nonce, char* body, size_t len )
+  {
+    memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
+    return int( len - TAG_LEN )
+           == ae_decrypt( ctx, nonce_buffer.data(), body, len, NULL, 0, body, NULL, AE_FINALIZE );
+  }
+
+  void encrypt_batch( size_t n, const Nonce nonces[], char* const texts[], const size_t lens[], bool ok[] )
+  {
+    const void* nonce_data[Session::BATCH_MAX] = {};
+    int int_lens[Session::BATCH_MAX] = {};
+    int results[Session::BATCH_MAX];
+
+    for ( size_t i = 0; i < n; i++ ) {
+      nonce_data[i] = nonces[i].data();
+      int_lens[i] = lens[i];
+    }
+    void* const* ae_texts = reinterpret_cast<void* const*>( texts );
+    fatal_assert( ae_encrypt_batch( ctx, n, nonce_data, ae_texts, int_lens, results ) == AE_SUCCESS );
+    for ( size_t i = 0; i < n; i++ ) {
+      ok[i] = ( results[i] == int( lens[i] + TAG_LEN ) );
+    }
+  }
+
+  void decrypt_batch( size_t n, const Nonce nonces[], char* const bodies[], const size_t lens[], bool ok[] )
+  {
+    const void* nonce_data[Session::BATCH_MAX] = {};
+    int int_lens[Session::BATCH_MAX] = {};
+    int results[Session::BATCH_MAX];
+
+    for ( size_t i = 0; i < n; i++ ) {
+      nonce_data[i] = nonces[i].data();
+      int_lens[i] = lens[i];
+    }
+    void* const* ae_texts = reinterpret_cast<void* const*>( bodies );
+    fatal_assert( ae_decrypt_batch( ctx, n, nonce_data, ae_texts, int_lens, results ) == AE_SUCCESS );
+    for ( size_t i = 0; i < n; i++ ) {
+      ok[i] = ( results[i] == int( lens[i] - TAG_LEN ) );
+    }
+  }
+
+  /* Not implemented */
+  OCBAEAD( const OCBAEAD& );
+  OCBAEAD& operator=( const OCBAEAD& );
+};
+
+#if USE_OPENSSL_AES
+#define HAVE_AES_256_GCM HAVE_DECL_EVP_AES_256_GCM
+#define HAVE_CHACHA20_POLY1305 HAVE_DECL_EVP_CHACHA20_POLY1305
+
+/* An EVP AEAD cipher, with a context for each direction that keeps the
+   key schedule and takes a new nonce for each packet */
+class EVPAEAD : public AEAD
+{
+private:
+  EVP_CIPHER_CTX* encrypt_ctx;
+  EVP_CIPHER_CTX* decrypt_ctx;
+
+  static EVP_CIPHER_CTX* new_ctx( const EVP_CIPHER* cipher, const unsigned char* key, int enc )
+  {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if ( ctx == NULL ) {
+      throw CryptoException( "Could not allocate cipher context." );
+    }
+    if ( EVP_CipherInit_ex( ctx, cipher, NULL, NULL, NULL, enc ) != 1
+         || EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_AEAD_SET_IVLEN, Nonce::NONCE_LEN, NULL ) != 1
+         || EVP_CipherInit_ex( ctx, NULL, NULL, key, NULL, enc ) != 1 ) {
+      EVP_CIPHER_CTX_free( ctx );
+      throw CryptoException( "Could not initialize cipher context." );
+    }
+    return ctx;
+  }
+
+public:
+  EVPAEAD( const EVP_CIPHER* cipher, const unsigned char* key )
+    : encrypt_ctx( new_ctx( cipher, key, 1 ) ), decrypt_ctx( NULL )
+  {
+    try {
+      decrypt_ctx = new_ctx( cipher, key, 0 );
+    } catch ( ... ) {
+      EVP_CIPHER_CTX_free( encrypt_ctx );
+      throw;
+    }
+  }
+
+  ~EVPAEAD()
+  {
+    EVP_CIPHER_CTX_free( encrypt_ctx );
+    EVP_CIPHER_CTX_free( decrypt_ctx );
+  }
+
+  bool encrypt( const Nonce& nonce, char* text, size_t len )
+  {
+    unsigned char* p = (unsigned char*)text;
+    int out_len, final_len;
+    return EVP_EncryptInit_ex( encrypt_ctx, NULL, NULL, NULL, (const unsigned char*)nonce.data() ) == 1
+           && EVP_EncryptUpdate( encrypt_ctx, p, &out_len, p, len ) == 1
+           && EVP_EncryptFinal_ex( encrypt_ctx, p + out_len, &final_len ) == 1
+           && size_t( out_len + final_len ) == len
+           && EVP_CIPHER_CTX_ctrl( encrypt_ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN, p + len ) == 1;
+  }
+
+  bool decrypt( const Nonce& nonce, char* body, size_t len )
+  {
+    unsigned char* p = (unsigned char*)body;
+    const size_t text_len = len - TAG_LEN;
+    int out_len, final_len;
+    return EVP_DecryptInit_ex( decrypt_ctx, NULL, NULL, NULL, (const unsigned char*)nonce.data() ) == 1
+           && EVP_CIPHER_CTX_ctrl( decrypt_ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN, p + text_len ) == 1
+           && EVP_DecryptUpdate( decrypt_ctx, p, &out_len, p, text_len ) == 1
+           && EVP_DecryptFinal_ex( decrypt_ctx, p + out_len, &final_len ) == 1
+           && size_t( out_len + final_len ) == text_len;
+  }
+
+  /* Not implemented */
+  EVPAEAD( const EVPAEAD& );
+  EVPAEAD& operator=( const EVPAEAD& );
+};
+
+#elif USE_NETTLE_AES
+#define HAVE_AES_256_GCM HAVE_DECL_GCM_AES256_ENCRYPT
+/* Nettle before 3.1 took ChaCha20-Poly1305 nonces of 8 bytes */
+#if HAVE_DECL_CHACHA_POLY1305_ENCRYPT && CHACHA_POLY1305_NONCE_SIZE == 12
+#define HAVE_CHACHA20_POLY1305 1
+#endif
+
+static bool tags_equal( const uint8_t* a, const uint8_t* b )
+{
+  uint8_t diff = 0;
+  for ( int i = 0; i < AEAD::TAG_LEN; i++ ) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
+
+/* Nettle's AEADs share a shape: set the nonce, run the text through, and
+   take the digest.  Ops names the functions for one of them. */
+template<class Ops>
+class NettleAEAD : public AEAD
+{
+private:
+  typename Ops::Context ctx;
+
+public:
+  NettleAEAD( const unsigned char* key ) : ctx() { Ops::set_key( &ctx, key ); }
+
+  ~NettleAEAD() { memset( &ctx, 0, sizeof ctx ); }
+
+  bool encrypt( const Nonce& nonce, char* text, size_t len )
+  {
+    uint8_t* p = (uint8_t*)text;
+    Ops::set_nonce( &ctx, (const uint8_t*)nonce.data() );
+    Ops::encrypt( &ctx, len, p, p );
+    Ops::digest( &ctx, TAG_LEN, p + len );
+    return true;
+  }
+
+  bool decrypt( const Nonce& nonce, char* body, size_t len )
+  {
+    uint8_t* p = (uint8_t*)body;
+    const size_t text_len = len - TAG_LEN;
+    uint8_t tag[TAG_LEN];
+    Ops::set_nonce( &ctx, (const uint8_t*)nonce.data() );
+    Ops::decrypt( &ctx, text_len, p, p );
+    Ops::digest( &ctx, TAG_LEN, tag );
+    return tags_equal( tag, p + text_len );
+  }
+};
+
+#if HAVE_AES_256_GCM
+struct GCMOps
+{
+  typedef struct gcm_aes256_ctx Context;
+  static void set_key( Context* ctx, const uint8_t* key ) { gcm_aes256_set_key( ctx, key ); }
+  static void set_nonce( Context* ctx, const uint8_t* nonce ) { gcm_aes256_set_iv( ctx, Nonce::NONCE_LEN, nonce ); }
+  static void encrypt( Context* ctx, size_t len, uint8_t* dst, const uint8_t* src )
+  {
+    gcm_aes256_encrypt( ctx, len, dst, src );
+  }
+  static void decrypt( Context* ctx, size_t len, uint8_t* dst, const uint8_t* src )
+  {
+    gcm_aes256_decrypt( ctx, len, dst, src );
+  }
+  static void digest( Context* ctx, size_t len, uint8_t* tag ) { gcm_aes256_digest( ctx, len, tag ); }
+};
+#endif
+
+#if HAVE_CHACHA20_POLY1305
+struct ChaChaPolyOps
+{
+  typedef struct chacha_poly1305_ctx Context;
+  static void set_key( Context* ctx, const uint8_t* key ) { chacha_poly1305_set_key( ctx, key ); }
+  static void set_nonce( Context* ctx, const uint8_t* nonce ) { chacha_poly1305_set_nonce( ctx, nonce ); }
+  static void encrypt( Context* ctx, size_t len, uint8_t* dst, const uint8_t* src )
+  {
+    chacha_poly1305_encrypt( ctx, len, dst, src );
+  }
+  static void decrypt( Context* ctx, size_t len, uint8_t* dst, const uint8_t* src )
+  {
+    chacha_poly1305_decrypt( ctx, len, dst, src );
+  }
+  static void digest( Context* ctx, size_t len, uint8_t* tag ) { chacha_poly1305_digest( ctx, len, tag ); }
+};
+#endif
+#endif
+
+void AEAD::encrypt_batch( size_t n, const Nonce nonces[], char* const texts[], const size_t lens[], bool ok[] )
+{
+  for ( size_t i = 0; i < n; i++ ) {
+    ok[i] = encrypt( nonces[i], texts[i], lens[i] );
+  }
+}
+
+void AEAD::decrypt_batch( size_t n, const Nonce nonces[], char* const bodies[], const size_t lens[], bool ok[] )
+{
+  for ( size_t i = 0; i < n; i++ ) {
+    ok[i] = decrypt( nonces[i], bodies[i], lens[i] );
+  }
+}
+
+bool AEAD::available( Algorithm algorithm )
+{
+  switch ( algorithm ) {
+    case AES_128_OCB:
+      return true;
+#if HAVE_AES_256_GCM
+    case AES_256_GCM:
+      return true;
+#endif
+#if HAVE_CHACHA20_POLY1305
+    case CHACHA20_POLY1305:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+AEAD* AEAD::create( Algorithm algorithm, const unsigned char* key )
+{
+  switch ( algorithm ) {
+    case AES_128_OCB:
+      return new OCBAEAD( key );
+#if USE_OPENSSL_AES
+#if HAVE_AES_256_GCM
+    case AES_256_GCM:
+      return new EVPAEAD( EVP_aes_256_gcm(), key );
+#endif
+#if HAVE_CHACHA20_POLY1305
+    case CHACHA20_POLY1305:
+      return new EVPAEAD( EVP_chacha20_poly1305(), key );
+#endif
+#elif USE_NETTLE_AES
+#if HAVE_AES_256_GCM
+    case AES_256_GCM:
+      return new NettleAEAD<GCMOps>( key );
+#endif
+#if HAVE_CHACHA20_POLY1305
+    case CHACHA20_POLY1305:
+      return new NettleAEAD<ChaChaPolyOps>( key );
+#endif
+#endif
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,67 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#ifndef AEAD_HPP
+#define AEAD_HPP
+
+#include "src/crypto/crypto.h"
+
+namespace Crypto {
+/* Authenticated encryption in place under one key, with a 12-byte
+   nonce and a TAG_LEN-byte tag after the text: AES-128-OCB through
+   ae.h, the others through the crypto library. */
+class AEAD
+{
+public:
+  static const int TAG_LEN = 16;
+
+  /* NULL if this build lacks the algorithm */
+  static AEAD* create( Algorithm algorithm, const unsigned char* key );
+  static bool available( Algorithm algorithm );
+
+  virtual ~AEAD() {}
+
+  /* len bytes of 16-byte-aligned text become ciphertext, followed by the tag */
+  virtual bool encrypt( const Nonce& nonce, char* text, size_t len ) = 0;
+  /* len bytes of 16-byte-aligned ciphertext and tag become text, if the tag matches */
+  virtual bool decrypt( const Nonce& nonce, char* body, size_t len ) = 0;
+
+  /* Either of the above on n texts at once, n being at most
+     Session::BATCH_MAX, setting ok[i] for each. By default they are
+     taken one at a time; a cipher may interleave their blocks. */
+  virtual void encrypt_batch( size_t n, const Nonce nonces[], char* const texts[], const size_t lens[], bool ok[] );
+  virtual void decrypt_batch(
+    size_t n, const Nonce nonces[], char* const bodies[], const size_t lens[], bool ok[] );
+};
+}
+
+#endif
@@ -0,0 +1,290 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#include "src/include/config.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "src/crypto/aesni.h"
+#include "src/util/fatal_assert.h"
+
+#if HAVE_AESNI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+using namespace AESNI;
+
+#if HAVE_AESNI
+
+#define TARGET_AES __attribute__( ( target( "aes" ) ) )
+#define TARGET_VAES __attribute__( ( target( "aes,avx512f,vaes" ) ) )
+
+/* CPUID bits, spelled out for older <cpuid.h> */
+static const unsigned int CPUID1_ECX_AES = 1 << 25;
+static const unsigned int CPUID1_ECX_OSXSAVE = 1 << 27;
+static const unsigned int CPUID7_EBX_AVX512F = 1 << 16;
+static const unsigned int CPUID7_ECX_VAES = 1 << 9;
+/* XCR0: SSE, AVX and the three AVX-512 register states, saved by the system */
+static const unsigned int XCR0_AVX512_STATE = 0xE6;
+
+static Level detect( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+  if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) || !( ecx & CPUID1_ECX_AES ) ) {
+    return NONE;
+  }
+
+#if HAVE_VAES
+  if ( ( ecx & CPUID1_ECX_OSXSAVE ) && __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx )
+       && ( ebx & CPUID7_EBX_AVX512F ) && ( ecx & CPUID7_ECX_VAES ) ) {
+    uint32_t xcr0, xcr0_high;
+    __asm__( "xgetbv" : "=a"( xcr0 ), "=d"( xcr0_high ) : "c"( 0 ) );
+    if ( ( xcr0 & XCR0_AVX512_STATE ) == XCR0_AVX512_STATE ) {
+      return VAES;
+    }
+  }
+#endif
+
+  return AES;
+}
+
+Level AESNI::level( void )
+{
+  static const Level detected = detect();
+
+  const char* impl = getenv( "MOSH_AES_IMPL" );
+  if ( impl && !strcmp( impl, "library" ) ) {
+    return NONE;
+  }
+  if ( impl && !strcmp( impl, "aesni" ) && detected > AES ) {
+    return AES;
+  }
+  return detected;
+}
+
+TARGET_AES static inline __m128i expand_step( __m128i key, __m128i assist )
+{
+  assist = _mm_shuffle_epi32( assist, 0xff );
+  key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  key = _mm_xor_si128( key, _mm_slli_si128( key, 4 ) );
+  return _mm_xor_si128( key, assist );
+}
+
+/* the round constant has to be an immediate */
+#define EXPAND( i, rcon ) rk[i] = expand_step( rk[i - 1], _mm_aeskeygenassist_si128( rk[i - 1], rcon ) )
+
+TARGET_AES static void expand_key( const unsigned char* key, __m128i* rk )
+{
+  rk[0] = _mm_loadu_si128( (const __m128i*)key );
+  EXPAND( 1, 0x01 );
+  EXPAND( 2, 0x02 );
+  EXPAND( 3, 0x04 );
+  EXPAND( 4, 0x08 );
+  EXPAND( 5, 0x10 );
+  EXPAND( 6, 0x20 );
+  EXPAND( 7, 0x40 );
+  EXPAND( 8, 0x80 );
+  EXPAND( 9, 0x1b );
+  EXPAND( 10, 0x36 );
+}
+
+#undef EXPAND
+
+void AESNI::set_encrypt_key( const unsigned char* key, Schedule& schedule )
+{
+  fatal_assert( schedule.level != NONE );
+  expand_key( key, (__m128i*)schedule.round_keys );
+}
+
+/* the equivalent inverse cipher: round keys in reverse, through InvMixColumns */
+TARGET_AES static void invert_key( __m128i* rk )
+{
+  __m128i inverse[ROUNDS + 1];
+  inverse[0] = rk[ROUNDS];
+  for ( int r = 1; r < ROUNDS; r++ ) {
+    inverse[r] = _mm_aesimc_si128( rk[ROUNDS - r] );
+  }
+  inverse[ROUNDS] = rk[0];
+  memcpy( rk, inverse, sizeof inverse );
+}
+
+void AESNI::set_decrypt_key( const unsigned char* key, Schedule& schedule )
+{
+  set_encrypt_key( key, schedule );
+  invert_key( (__m128i*)schedule.round_keys );
+}
+
+/* N blocks at p, interleaved so the AES unit has N rounds in flight */
+template<unsigned int N>
+TARGET_AES static inline void encrypt_n( __m128i* p, const __m128i* rk )
+{
+  __m128i b[N];
+  for ( unsigned int i = 0; i < N; i++ ) {
+    b[i] = _mm_xor_si128( _mm_loadu_si128( p + i ), rk[0] );
+  }
+  for ( int r = 1; r < ROUNDS; r++ ) {
+    for ( unsigned int i = 0; i < N; i++ ) {
+      b[i] = _mm_aesenc_si128( b[i], rk[r] );
+    }
+  }
+  for ( unsigned int i = 0; i < N; i++ ) {
+    _mm_storeu_si128( p + i, _mm_aesenclast_si128( b[i], rk[ROUNDS] ) );
+  }
+}
+
+template<unsigned int N>
+TARGET_AES static inline void decrypt_n( __m128i* p, const __m128i* rk )
+{
+  __m128i b[N];
+  for ( unsigned int i = 0; i < N; i++ ) {
+    b[i] = _mm_xor_si128( _mm_loadu_si128( p + i ), rk[0] );
+  }
+  for ( int r = 1; r < ROUNDS; r++ ) {
+    for ( unsigned int i = 0; i < N; i++ ) {
+      b[i] = _mm_aesdec_si128( b[i], rk[r] );
+    }
+  }
+  for ( unsigned int i = 0; i < N; i++ ) {
+    _mm_storeu_si128( p + i, _mm_aesdeclast_si128( b[i], rk[ROUNDS] ) );
+  }
+}
+
+TARGET_AES static void encrypt_aesni( __m128i* p, unsigned n, const __m128i* rk )
+{
+  for ( ; n >= 8; n -= 8, p += 8 ) {
+    encrypt_n<8>( p, rk );
+  }
+  if ( n >= 4 ) {
+    encrypt_n<4>( p, rk );
+    n -= 4;
+    p += 4;
+  }
+  for ( ; n > 0; n--, p++ ) {
+    encrypt_n<1>( p, rk );
+  }
+}
+
+TARGET_AES static void decrypt_aesni( __m128i* p, unsigned n, const __m128i* rk )
+{
+  for ( ; n >= 8; n -= 8, p += 8 ) {
+    decrypt_n<8>( p, rk );
+  }
+  if ( n >= 4 ) {
+    decrypt_n<4>( p, rk );
+    n -= 4;
+    p += 4;
+  }
+  for ( ; n > 0; n--, p++ ) {
+    decrypt_n<1>( p, rk );
+  }
+}
+
+#if HAVE_VAES
+/* Eight blocks as two 512-bit registers of four; the rest with AES-NI */
+TARGET_VAES static void encrypt_vaes( __m128i* p, unsigned n, const __m128i* rk )
+{
+  if ( n >= 8 ) {
+    __m512i k[ROUNDS + 1];
+    for ( int r = 0; r <= ROUNDS; r++ ) {
+      k[r] = _mm512_maskz_broadcast_i32x4( 0xFFFF, rk[r] );
+    }
+    for ( ; n >= 8; n -= 8, p += 8 ) {
+      __m512i b0 = _mm512_xor_si512( _mm512_loadu_si512( p ), k[0] );
+      __m512i b1 = _mm512_xor_si512( _mm512_loadu_si512( p + 4 ), k[0] );
+      for ( int r = 1; r < ROUNDS; r++ ) {
+        b0 = _mm512_aesenc_epi128( b0, k[r] );
+        b1 = _mm512_aesenc_epi128( b1, k[r] );
+      }
+      _mm512_storeu_si512( p, _mm512_aesenclast_epi128( b0, k[ROUNDS] ) );
+      _mm512_storeu_si512( p + 4, _mm512_aesenclast_epi128( b1, k[ROUNDS] ) );
+    }
+  }
+  encrypt_aesni( p, n, rk );
+}
+
+TARGET_VAES static void decrypt_vaes( __m128i* p, unsigned n, const __m128i* rk )
+{
+  if ( n >= 8 ) {
+    __m512i k[ROUNDS + 1];
+    for ( int r = 0; r <= ROUNDS; r++ ) {
+      k[r] = _mm512_maskz_broadcast_i32x4( 0xFFFF, rk[r] );
+    }
+    for ( ; n >= 8; n -= 8, p += 8 ) {
+      __m512i b0 = _mm512_xor_si512( _mm512_loadu_si512( p ), k[0] );
+      __m512i b1 = _mm512_xor_si512( _mm512_loadu_si512( p + 4 ), k[0] );
+      for ( int r = 1; r < ROUNDS; r++ ) {
+        b0 = _mm512_aesdec_epi128( b0, k[r] );
+        b1 = _mm512_aesdec_epi128( b1, k[r] );
+      }
+      _mm512_storeu_si512( p, _mm512_aesdeclast_epi128( b0, k[ROUNDS] ) );
+      _mm512_storeu_si512( p + 4, _mm512_aesdeclast_epi128( b1, k[ROUNDS] ) );
+    }
+  }
+  decrypt_aesni( p, n, rk );
+}
+#endif
+
+void AESNI::encrypt( const unsigned char* in, unsigned char* out, const Schedule& schedule )
+{
+  alignas( 16 ) unsigned char block[16];
+  memcpy( block, in, sizeof block );
+  encrypt_aesni( (__m128i*)block, 1, (const __m128i*)schedule.round_keys );
+  memcpy( out, block, sizeof block );
+}
+
+void AESNI::encrypt_blocks( unsigned char* blocks, unsigned n, const Schedule& schedule )
+{
+#if HAVE_VAES
+  if ( schedule.level == VAES ) {
+    encrypt_vaes( (__m128i*)blocks, n, (const __m128i*)schedule.round_keys );
+    return;
+  }
+#endif
+  encrypt_aesni( (__m128i*)blocks, n, (const __m128i*)schedule.round_keys );
+}
+
+void AESNI::decrypt_blocks( unsigned char* blocks, unsigned n, const Schedule& schedule )
+{
+#if HAVE_VAES
+  if ( schedule.level == VAES ) {
+    decrypt_vaes( (__m128i*)blocks, n, (const __m128i*)schedule.round_keys );
+    return;
+  }
+#endif
+  decrypt_aesni( (__m128i*)blocks, n, (const __m128i*)schedule.round_keys );
+}
+
+#endif /* HAVE_AESNI */
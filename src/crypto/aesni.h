@@ -0,0 +1,71 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#ifndef AESNI_HPP
+#define AESNI_HPP
+
+/* AES-128 with the x86 AES instructions, which the OCB code uses in
+   place of the crypto library's AES where the processor has them. */
+
+namespace AESNI {
+enum Level
+{
+  NONE, /* no AES instructions: use the crypto library */
+  AES,  /* AES-NI, a block per instruction */
+  VAES  /* VAES on AVX-512 registers, four blocks per instruction */
+};
+
+/* What the processor has, limited by $MOSH_AES_IMPL ("library" or "aesni") */
+Level level( void );
+
+static const int ROUNDS = 10;
+
+class Schedule
+{
+public:
+  alignas( 16 ) unsigned char round_keys[( ROUNDS + 1 ) * 16];
+  Level level;
+};
+
+/* Both need schedule.level, taken from level(), above NONE. */
+void set_encrypt_key( const unsigned char* key, Schedule& schedule );
+void set_decrypt_key( const unsigned char* key, Schedule& schedule );
+
+/* One block; in and out may be the same, and need not be aligned. */
+void encrypt( const unsigned char* in, unsigned char* out, const Schedule& schedule );
+
+/* n independent blocks in place, eight at a time where there are eight */
+void encrypt_blocks( unsigned char* blocks, unsigned n, const Schedule& schedule );
+void decrypt_blocks( unsigned char* blocks, unsigned n, const Schedule& schedule );
+}
+
+#endif
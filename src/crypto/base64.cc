@@ -67,11 +67,12 @@ static unsigned char base64_char_to_sixbit( unsigned char c )
 
 bool base64_decode( const char* b64, const size_t b64_len, uint8_t* raw, size_t* raw_len )
 {
-  fatal_assert( b64_len == 24 ); /* only useful for Mosh keys */
-  fatal_assert( *raw_len == 16 );
+  /* only useful for Mosh keys */
+  fatal_assert( ( b64_len == 24 && *raw_len == 16 ) || ( b64_len == 44 && *raw_len == 32 ) );
 
+  const size_t chars = ( *raw_len * 4 + 2 ) / 3;
   uint32_t bytes = 0;
-  for ( int i = 0; i < 22; i++ ) {
+  for ( size_t i = 0; i < chars; i++ ) {
     unsigned char sixbit = base64_char_to_sixbit( *( b64++ ) );
     if ( sixbit > 0x3f ) {
       return false;
@@ -87,21 +88,28 @@ bool base64_decode( const char* b64, const size_t b64_len, uint8_t* raw, size_t*
       bytes = 0;
     }
   }
-  /* last byte of output */
-  *raw = bytes >> 4;
-  if ( b64[0] != '=' || b64[1] != '=' ) {
-    return false;
+  /* last byte or two of output */
+  if ( *raw_len % 3 == 1 ) {
+    raw[0] = bytes >> 4;
+  } else {
+    raw[0] = bytes >> 10;
+    raw[1] = bytes >> 2;
+  }
+  for ( size_t i = chars; i < b64_len; i++ ) {
+    if ( *( b64++ ) != '=' ) {
+      return false;
+    }
   }
   return true;
 }
 
 void base64_encode( const uint8_t* raw, const size_t raw_len, char* b64, const size_t b64_len )
 {
-  fatal_assert( b64_len == 24 ); /* only useful for Mosh keys */
-  fatal_assert( raw_len == 16 );
+  /* only useful for Mosh keys */
+  fatal_assert( ( b64_len == 24 && raw_len == 16 ) || ( b64_len == 44 && raw_len == 32 ) );
 
-  /* first 15 bytes of input */
-  for ( int i = 0; i < 5; i++ ) {
+  /* whole groups of 3 bytes of input */
+  for ( size_t i = 0; i < raw_len / 3; i++ ) {
     uint32_t bytes = ( raw[0] << 16 ) | ( raw[1] << 8 ) | raw[2];
     b64[0] = table[( bytes >> 18 ) & 0x3f];
     b64[1] = table[( bytes >> 12 ) & 0x3f];
@@ -111,10 +119,17 @@ void base64_encode( const uint8_t* raw, const size_t raw_len, char* b64, const s
     b64 += 4;
   }
 
-  /* last byte of input, last 4 of output */
-  uint8_t lastchar = *raw;
-  b64[0] = table[( lastchar >> 2 ) & 0x3f];
-  b64[1] = table[( lastchar << 4 ) & 0x3f];
-  b64[2] = '=';
+  /* last byte or two of input, last 4 of output */
+  if ( raw_len % 3 == 1 ) {
+    uint8_t lastchar = *raw;
+    b64[0] = table[( lastchar >> 2 ) & 0x3f];
+    b64[1] = table[( lastchar << 4 ) & 0x3f];
+    b64[2] = '=';
+  } else {
+    uint32_t bytes = ( raw[0] << 8 ) | raw[1];
+    b64[0] = table[( bytes >> 10 ) & 0x3f];
+    b64[1] = table[( bytes >> 4 ) & 0x3f];
+    b64[2] = table[( bytes << 2 ) & 0x3f];
+  }
   b64[3] = '=';
 }
@@ -39,6 +39,7 @@
 
 #include <sys/resource.h>
 
+#include "src/crypto/aead.h"
 #include "src/crypto/base64.h"
 #include "src/crypto/byteorder.h"
 #include "src/crypto/crypto.h"
@@ -105,66 +106,104 @@ AlignedBuffer::AlignedBuffer( size_t len, const char* data ) : m_len( len ), m_a
   }
 }
 
-Base64Key::Base64Key( std::string printable_key )
+static const char* const algorithm_names[] = { "none", "aes-128-ocb", "aes-256-gcm", "chacha20-poly1305" };
+
+Algorithm Crypto::algorithm_from_name( const char* name )
 {
-  if ( printable_key.length() != 22 ) {
-    throw CryptoException( "Key must be 22 letters long." );
+  for ( int i = AES_128_OCB; i <= CHACHA20_POLY1305; i++ ) {
+    if ( 0 == strcmp( name, algorithm_names[i] ) && AEAD::available( Algorithm( i ) ) ) {
+      return Algorithm( i );
+    }
   }
+  return ALGORITHM_NONE;
+}
+
+const char* Crypto::algorithm_name( Algorithm algorithm )
+{
+  fatal_assert( algorithm >= ALGORITHM_NONE && algorithm <= CHACHA20_POLY1305 );
+  return algorithm_names[algorithm];
+}
 
-  std::string base64 = printable_key + "==";
+Base64Key::Base64Key( std::string printable_key ) : algorithm( AES_128_OCB ), key()
+{
+  const size_t colon = printable_key.find( ':' );
+  if ( colon != std::string::npos ) {
+    algorithm = algorithm_from_name( printable_key.substr( 0, colon ).c_str() );
+    if ( algorithm == AES_128_OCB ) {
+      throw CryptoException( "aes-128-ocb keys are written without a prefix." );
+    }
+    if ( algorithm == ALGORITHM_NONE ) {
+      throw CryptoException( "Key is for a cipher this build does not have." );
+    }
+    printable_key.erase( 0, colon + 1 );
+  }
+
+  const size_t letters = ( len() * 4 + 2 ) / 3;
+  if ( printable_key.length() != letters ) {
+    throw CryptoException( "Key must be " + std::to_string( letters ) + " letters long." );
+  }
 
-  size_t len = 16;
-  if ( !base64_decode( base64.data(), 24, key, &len ) ) {
+  std::string base64 = printable_key + ( len() == 16 ? "==" : "=" );
+
+  size_t decoded_len = len();
+  if ( !base64_decode( base64.data(), base64.size(), key, &decoded_len ) ) {
     throw CryptoException( "Key must be well-formed base64." );
   }
 
-  if ( len != 16 ) {
-    throw CryptoException( "Key must represent 16 octets." );
+  if ( decoded_len != len() ) {
+    throw CryptoException( "Key must represent " + std::to_string( len() ) + " octets." );
   }
 
-  /* to catch changes after the first 128 bits */
-  if ( printable_key != this->printable_key() ) {
-    throw CryptoException( "Base64 key was not encoded 128-bit key." );
+  /* to catch changes after the last whole octet */
+  if ( printable_key != this->printable_key().substr( colon == std::string::npos ? 0 : colon + 1 ) ) {
+    throw CryptoException( "Base64 key was not encoded " + std::to_string( len() * 8 ) + "-bit key." );
   }
 }
 
-Base64Key::Base64Key()
+Base64Key::Base64Key( Algorithm s_algorithm ) : algorithm( s_algorithm ), key()
 {
-  PRNG().fill( key, sizeof( key ) );
+  PRNG().fill( key, len() );
 }
 
-Base64Key::Base64Key( PRNG& prng )
+Base64Key::Base64Key( PRNG& prng, Algorithm s_algorithm ) : algorithm( s_algorithm ), key()
 {
-  prng.fill( key, sizeof( key ) );
+  prng.fill( key, len() );
 }
 
 std::string Base64Key::printable_key( void ) const
 {
-  char base64[24];
+  char base64[44];
+  const size_t base64_len = len() == 16 ? 24 : 44;
+  const size_t letters = ( len() * 4 + 2 ) / 3;
 
-  base64_encode( key, 16, base64, 24 );
+  base64_encode( key, len(), base64, base64_len );
 
-  if ( ( base64[23] != '=' ) || ( base64[22] != '=' ) ) {
-    throw CryptoException( std::string( "Unexpected output from base64_encode: " ) + std::string( base64, 24 ) );
+  for ( size_t i = letters; i < base64_len; i++ ) {
+    if ( base64[i] != '=' ) {
+      throw CryptoException( std::string( "Unexpected output from base64_encode: " )
+                             + std::string( base64, base64_len ) );
+    }
   }
 
-  base64[22] = 0;
-  return std::string( base64 );
+  if ( algorithm == AES_128_OCB ) {
+    return std::string( base64, letters );
+  }
+  return std::string( algorithm_name( algorithm ) ) + ":" + std::string( base64, letters );
 }
 
+/* where the Message interface puts the text in bounce_buffer, aligned with room for the nonce */
+static const size_t BOUNCE_TEXT_OFFSET = 16;
+
 Session::Session( Base64Key s_key )
-  : key( s_key ), ctx_buf( ae_ctx_sizeof() ), ctx( (ae_ctx*)ctx_buf.data() ), blocks_encrypted( 0 ),
-    plaintext_buffer( RECEIVE_MTU ), ciphertext_buffer( RECEIVE_MTU ), nonce_buffer( Nonce::NONCE_LEN )
+  : key( s_key ), aead( AEAD::create( key.get_algorithm(), key.data() ) ), blocks_encrypted( 0 ),
+    bounce_buffer( BOUNCE_TEXT_OFFSET + RECEIVE_MTU )
 {
-  if ( AE_SUCCESS != ae_init( ctx, key.data(), 16, 12, 16 ) ) {
-    throw CryptoException( "Could not initialize AES-OCB context." );
+  if ( !aead ) {
+    throw CryptoException( std::string( algorithm_name( key.get_algorithm() ) ) + " is not available." );
   }
 }
 
-Session::~Session()
-{
-  fatal_assert( ae_clear( ctx ) == AE_SUCCESS );
-}
+Session::~Session() {}
 
 Nonce::Nonce( uint64_t val )
 {
@@ -191,30 +230,8 @@ Nonce::Nonce( const char* s_bytes, size_t len )
   memcpy( bytes + 4, s_bytes, 8 );
 }
 
-const std::string Session::encrypt( const Message& plaintext )
+void Session::count_blocks( size_t pt_len )
 {
-  const size_t pt_len = plaintext.text.size();
-  const int ciphertext_len = pt_len + 16;
-
-  assert( (size_t)ciphertext_len <= ciphertext_buffer.len() );
-  assert( pt_len <= plaintext_buffer.len() );
-
-  memcpy( plaintext_buffer.data(), plaintext.text.data(), pt_len );
-  memcpy( nonce_buffer.data(), plaintext.nonce.data(), Nonce::NONCE_LEN );
-
-  if ( ciphertext_len
-       != ae_encrypt( ctx,                      /* ctx */
-                      nonce_buffer.data(),      /* nonce */
-                      plaintext_buffer.data(),  /* pt */
-                      pt_len,                   /* pt_len */
-                      NULL,                     /* ad */
-                      0,                        /* ad_len */
-                      ciphertext_buffer.data(), /* ct */
-                      NULL,                     /* tag */
-                      AE_FINALIZE ) ) {         /* final */
-    throw CryptoException( "ae_encrypt() returned error." );
-  }
-
   blocks_encrypted += pt_len >> 4;
   if ( pt_len & 0xF ) {
     /* partial block */
@@ -232,53 +249,166 @@ const std::string Session::encrypt( const Message& plaintext )
      We deem it unlikely that a legitimate user will send 4 PB through a Mosh
      session.  If it happens, we simply kill the session.  The server and
      client use the same key, so we actually need to die after 2^47 blocks.
+     AES-GCM degrades the same way; the limit is kept for ChaCha20-Poly1305
+     too, which would last far longer.
   */
   if ( blocks_encrypted >> 47 ) {
     throw CryptoException( "Encrypted 2^47 blocks.", true );
   }
+}
 
-  std::string text( ciphertext_buffer.data(), ciphertext_len );
+const std::string Session::encrypt( const Message& plaintext )
+{
+  const size_t pt_len = plaintext.text.size();
+  char* text = bounce_buffer.data() + BOUNCE_TEXT_OFFSET;
+  const size_t room = bounce_buffer.len() - BOUNCE_TEXT_OFFSET;
 
-  return plaintext.nonce.cc_str() + text;
+  assert( pt_len + TAILROOM <= room );
+
+  memcpy( text, plaintext.text.data(), pt_len );
+
+  const Span datagram
+    = encrypt_in_place( plaintext.nonce, Span( text, pt_len, BOUNCE_TEXT_OFFSET, room - pt_len ) );
+
+  return std::string( datagram.data, datagram.len );
 }
 
 const Message Session::decrypt( const char* str, size_t len )
 {
-  if ( len < 24 ) {
+  const size_t headroom = BOUNCE_TEXT_OFFSET - HEADROOM;
+  char* datagram = bounce_buffer.data() + headroom;
+
+  assert( len <= bounce_buffer.len() - headroom );
+
+  memcpy( datagram, str, len );
+
+  uint64_t nonce_val;
+  const Span text
+    = decrypt_in_place( Span( datagram, len, headroom, bounce_buffer.len() - headroom - len ), nonce_val );
+
+  return Message( Nonce( nonce_val ), std::string( text.data, text.len ) );
+}
+
+void Session::check_room( const Span& text )
+{
+  if ( ( text.headroom < HEADROOM ) || ( text.tailroom < TAILROOM ) ) {
+    throw CryptoException( "No room around text to encrypt in place." );
+  }
+
+  if ( (uintptr_t)text.data & 0xF ) {
+    throw CryptoException( "Text to encrypt in place must be 16-byte aligned." );
+  }
+}
+
+Span Session::encrypt_in_place( const Nonce& nonce, const Span& text )
+{
+  check_room( text );
+
+  const int ciphertext_len = text.len + ADDED_BYTES;
+
+  if ( !aead->encrypt( nonce, text.data, text.len ) ) {
+    throw CryptoException( "AEAD encryption returned error." );
+  }
+
+  count_blocks( text.len );
+
+  char* datagram = text.data - HEADROOM;
+  memcpy( datagram, nonce.cc_data(), HEADROOM );
+
+  return Span( datagram, HEADROOM + ciphertext_len, text.headroom - HEADROOM, text.tailroom - TAILROOM );
+}
+
+Span Session::decrypt_in_place( const Span& datagram, uint64_t& nonce_val )
+{
+  if ( datagram.len < HEADROOM + TAILROOM ) {
     throw CryptoException( "Ciphertext must contain nonce and tag." );
   }
 
-  int body_len = len - 8;
-  int pt_len = body_len - 16;
+  char* body = datagram.data + HEADROOM;
+  const int body_len = datagram.len - HEADROOM;
+  const int pt_len = body_len - ADDED_BYTES;
 
-  if ( pt_len < 0 ) { /* super-assertion that pt_len does not equal AE_INVALID */
-    fprintf( stderr, "BUG.\n" );
-    exit( 1 );
+  if ( (uintptr_t)body & 0xF ) {
+    throw CryptoException( "Ciphertext to decrypt in place must be 16-byte aligned." );
   }
 
-  assert( (size_t)body_len <= ciphertext_buffer.len() );
-  assert( (size_t)pt_len <= plaintext_buffer.len() );
-
-  Nonce nonce( str, 8 );
-  memcpy( ciphertext_buffer.data(), str + 8, body_len );
-  memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
-
-  if ( pt_len
-       != ae_decrypt( ctx,                      /* ctx */
-                      nonce_buffer.data(),      /* nonce */
-                      ciphertext_buffer.data(), /* ct */
-                      body_len,                 /* ct_len */
-                      NULL,                     /* ad */
-                      0,                        /* ad_len */
-                      plaintext_buffer.data(),  /* pt */
-                      NULL,                     /* tag */
-                      AE_FINALIZE ) ) {         /* final */
+  const Nonce nonce( datagram.data, HEADROOM );
+  if ( !aead->decrypt( nonce, body, body_len ) ) {
     throw CryptoException( "Packet failed integrity check." );
   }
 
-  const Message ret( nonce, std::string( plaintext_buffer.data(), pt_len ) );
+  nonce_val = nonce.val();
+  return Span( body, pt_len, datagram.headroom + HEADROOM, datagram.tailroom + TAILROOM );
+}
 
-  return ret;
+void Session::encrypt_batch( size_t n, const Nonce nonces[], Span spans[] )
+{
+  char* texts[BATCH_MAX] = {};
+  size_t lens[BATCH_MAX] = {};
+  bool ok[BATCH_MAX];
+
+  fatal_assert( n <= BATCH_MAX );
+
+  for ( size_t i = 0; i < n; i++ ) {
+    check_room( spans[i] );
+    texts[i] = spans[i].data;
+    lens[i] = spans[i].len;
+  }
+
+  aead->encrypt_batch( n, nonces, texts, lens, ok );
+
+  for ( size_t i = 0; i < n; i++ ) {
+    if ( !ok[i] ) {
+      throw CryptoException( "AEAD encryption returned error." );
+    }
+
+    count_blocks( lens[i] );
+
+    char* datagram = texts[i] - HEADROOM;
+    memcpy( datagram, nonces[i].cc_data(), HEADROOM );
+
+    spans[i] = Span(
+      datagram, HEADROOM + lens[i] + ADDED_BYTES, spans[i].headroom - HEADROOM, spans[i].tailroom - TAILROOM );
+  }
+}
+
+void Session::decrypt_batch( size_t n, Span spans[], uint64_t nonce_vals[], bool ok[] )
+{
+  Nonce nonces[BATCH_MAX];
+  char* bodies[BATCH_MAX] = {};
+  size_t lens[BATCH_MAX] = {};
+  size_t which[BATCH_MAX]; /* the datagram each body came from */
+  bool authentic[BATCH_MAX];
+  size_t m = 0;
+
+  fatal_assert( n <= BATCH_MAX );
+
+  for ( size_t i = 0; i < n; i++ ) {
+    ok[i] = false;
+    if ( spans[i].len < HEADROOM + TAILROOM ) {
+      continue;
+    }
+
+    bodies[m] = spans[i].data + HEADROOM;
+    if ( (uintptr_t)bodies[m] & 0xF ) {
+      throw CryptoException( "Ciphertext to decrypt in place must be 16-byte aligned." );
+    }
+    lens[m] = spans[i].len - HEADROOM;
+    nonces[m] = Nonce( spans[i].data, HEADROOM );
+    which[m++] = i;
+  }
+
+  aead->decrypt_batch( m, nonces, bodies, lens, authentic );
+
+  for ( size_t j = 0; j < m; j++ ) {
+    if ( authentic[j] ) {
+      const size_t i = which[j];
+      ok[i] = true;
+      nonce_vals[i] = nonces[j].val();
+      spans[i] = Span(
+        bodies[j], lens[j] - ADDED_BYTES, spans[i].headroom + HEADROOM, spans[i].tailroom + TAILROOM );
+    }
+  }
 }
 
 static rlim_t saved_core_rlimit;
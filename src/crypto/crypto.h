@@ -33,12 +33,11 @@
 #ifndef CRYPTO_HPP
 #define CRYPTO_HPP
 
-#include "src/crypto/ae.h"
-
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <memory>
 #include <string>
 
 long int myatoi( const char* str );
@@ -85,17 +84,53 @@ private:
   AlignedBuffer& operator=( const AlignedBuffer& );
 };
 
+/* Bytes in a caller-owned buffer, with how much of the buffer is free
+   before and after them. */
+class Span
+{
+public:
+  char* data;
+  size_t len;
+  size_t headroom, tailroom;
+
+  Span( char* s_data = NULL, size_t s_len = 0, size_t s_headroom = 0, size_t s_tailroom = 0 )
+    : data( s_data ), len( s_len ), headroom( s_headroom ), tailroom( s_tailroom )
+  {}
+};
+
+/* Authenticated encryption for a session, chosen by mosh-server and
+   carried in the key it prints.  AES-128-OCB is the default; the others
+   are built in where the crypto library has them. */
+enum Algorithm
+{
+  ALGORITHM_NONE = 0,
+  AES_128_OCB = 1,
+  AES_256_GCM = 2,
+  CHACHA20_POLY1305 = 3
+};
+
+/* "aes-128-ocb", "aes-256-gcm" or "chacha20-poly1305"; ALGORITHM_NONE
+   if unknown or not built in */
+Algorithm algorithm_from_name( const char* name );
+const char* algorithm_name( Algorithm algorithm );
+
+/* An AES-128-OCB key prints as 22 letters of base64, as it always has.
+   Keys for the others are 256 bits, and print as the algorithm's name,
+   a colon and 43 letters. */
 class Base64Key
 {
 private:
-  unsigned char key[16];
+  Algorithm algorithm;
+  unsigned char key[32];
 
 public:
-  Base64Key(); /* random key */
-  Base64Key( PRNG& prng );
+  explicit Base64Key( Algorithm s_algorithm = AES_128_OCB ); /* random key */
+  Base64Key( PRNG& prng, Algorithm s_algorithm = AES_128_OCB );
   Base64Key( std::string printable_key );
   std::string printable_key( void ) const;
   unsigned char* data( void ) { return key; }
+  size_t len( void ) const { return algorithm == AES_128_OCB ? 16 : 32; }
+  Algorithm get_algorithm( void ) const { return algorithm; }
 };
 
 class Nonce
@@ -107,10 +142,11 @@ private:
   char bytes[NONCE_LEN];
 
 public:
-  Nonce( uint64_t val );
+  Nonce( uint64_t val = 0 );
   Nonce( const char* s_bytes, size_t len );
 
   std::string cc_str( void ) const { return std::string( bytes + 4, 8 ); }
+  const char* cc_data( void ) const { return bytes + 4; }
   const char* data( void ) const { return bytes; }
   uint64_t val( void ) const;
 };
@@ -128,22 +164,28 @@ public:
   Message( const Nonce& s_nonce, const std::string& s_text ) : nonce( s_nonce ), text( s_text ) {}
 };
 
+class AEAD;
+
 class Session
 {
 private:
   Base64Key key;
-  AlignedBuffer ctx_buf;
-  ae_ctx* ctx;
+  std::unique_ptr<AEAD> aead;
   uint64_t blocks_encrypted;
 
-  AlignedBuffer plaintext_buffer;
-  AlignedBuffer ciphertext_buffer;
-  AlignedBuffer nonce_buffer;
+  AlignedBuffer bounce_buffer; /* for the Message interface */
+
+  void count_blocks( size_t pt_len );
+  static void check_room( const Span& text );
 
 public:
   static const int RECEIVE_MTU = 2048;
   /* Overhead (not counting the nonce, which is handled by network transport) */
-  static const int ADDED_BYTES = 16 /* final OCB block */;
+  static const int ADDED_BYTES = 16 /* tag */;
+  /* Room that encrypting in place needs: before the text, for the sent
+     part of the nonce, and after it, for the tag */
+  static const int HEADROOM = 8;
+  static const int TAILROOM = ADDED_BYTES;
 
   Session( Base64Key s_key );
   ~Session();
@@ -152,6 +194,25 @@ public:
   const Message decrypt( const char* str, size_t len );
   const Message decrypt( const std::string& ciphertext ) { return decrypt( ciphertext.data(), ciphertext.size() ); }
 
+  /* The same, without copies. The text must start 16-byte aligned, with
+     HEADROOM and TAILROOM bytes of room around it; it is encrypted where
+     it is, and the datagram (nonce, ciphertext, tag) is returned. */
+  Span encrypt_in_place( const Nonce& nonce, const Span& text );
+  /* Decrypts a datagram where it is, returning its text, which starts
+     HEADROOM bytes in and must be 16-byte aligned. */
+  Span decrypt_in_place( const Span& datagram, uint64_t& nonce_val );
+
+  /* Most datagrams encrypt_batch() and decrypt_batch() take at once */
+  static const size_t BATCH_MAX = 16;
+
+  /* encrypt_in_place() on n texts at once, whose blocks the cipher may
+     interleave: each of spans[] is replaced by its datagram. */
+  void encrypt_batch( size_t n, const Nonce nonces[], Span spans[] );
+  /* decrypt_in_place() on n datagrams at once. Where ok[i], spans[i] is
+     replaced by its text and nonce_vals[i] is set; otherwise that datagram
+     was too short or failed its integrity check. */
+  void decrypt_batch( size_t n, Span spans[], uint64_t nonce_vals[], bool ok[] );
+
   Session( const Session& );
   Session& operator=( const Session& );
 };
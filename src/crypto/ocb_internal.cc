@@ -366,7 +366,7 @@
 
 #include <openssl/evp.h>                            /* http://openssl.org/ */
 
-namespace ocb_aes {
+namespace ocb_aes_lib {
 
 typedef EVP_CIPHER_CTX KEY;
 
@@ -469,7 +469,7 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 	}
 }
 
-}  // namespace ocb_aes
+}  // namespace ocb_aes_lib
 
 #define BPI 4  /* Number of blocks in buffer per ECB call */
 
@@ -479,7 +479,7 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 
 #include <CommonCrypto/CommonCryptor.h>
 
-namespace ocb_aes {
+namespace ocb_aes_lib {
 
 typedef struct {
 	CCCryptorRef ref;
@@ -557,7 +557,7 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 	ecb_encrypt_blks(blks, nblks, key);
 }
 
-}  // namespace ocb_aes
+}  // namespace ocb_aes_lib
 
 #define BPI 4  /* Number of blocks in buffer per ECB call */
 
@@ -567,7 +567,7 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 
 #include <nettle/aes.h>
 
-namespace ocb_aes {
+namespace ocb_aes_lib {
 
 typedef struct aes128_ctx KEY;
 
@@ -601,7 +601,7 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 	nettle_aes128_decrypt(key, nblks * AES_BLOCK_SIZE, (unsigned char*)blks, (unsigned char*)blks);
 }
 
-}  // namespace ocb_aes
+}  // namespace ocb_aes_lib
 
 #define BPI 4  /* Number of blocks in buffer per ECB call */
 
@@ -609,6 +609,86 @@ static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
 #error "No AES implementation selected."
 #endif
 
+/*---------------*/
+#if HAVE_AESNI
+/*---------------*/
+
+/* The AES instructions, where the processor has them, in front of the
+   library's AES. Eight blocks at a time keep the AES unit busy, and
+   give the offset and checksum computations in the OCB loops below
+   eight blocks to work on between calls. */
+
+#include "src/crypto/aesni.h"
+
+namespace ocb_aes {
+
+struct KEY {
+	AESNI::Schedule schedule;
+	ocb_aes_lib::KEY *lib;                  /* NULL while using AESNI   */
+};
+
+static KEY *KEY_new() {
+	KEY *key = new KEY();
+	key->schedule.level = AESNI::level();
+	key->lib = (key->schedule.level == AESNI::NONE) ? ocb_aes_lib::KEY_new() : NULL;
+	return key;
+}
+
+static void KEY_delete(KEY *key) {
+	if (key->lib)
+		ocb_aes_lib::KEY_delete(key->lib);
+	memset(key, 0, sizeof(KEY));
+	delete key;
+}
+
+static void set_encrypt_key(const unsigned char *user_key, int bits, KEY *key) {
+	if (key->lib) {
+		ocb_aes_lib::set_encrypt_key(user_key, bits, key->lib);
+		return;
+	}
+	fatal_assert(bits == 128);
+	AESNI::set_encrypt_key(user_key, key->schedule);
+}
+
+static void set_decrypt_key(const unsigned char *user_key, int bits, KEY *key) {
+	if (key->lib) {
+		ocb_aes_lib::set_decrypt_key(user_key, bits, key->lib);
+		return;
+	}
+	fatal_assert(bits == 128);
+	AESNI::set_decrypt_key(user_key, key->schedule);
+}
+
+static void encrypt(unsigned char *in, unsigned char *out, KEY *key) {
+	if (key->lib)
+		ocb_aes_lib::encrypt(in, out, key->lib);
+	else
+		AESNI::encrypt(in, out, key->schedule);
+}
+
+static void ecb_encrypt_blks(block *blks, unsigned nblks, KEY *key) {
+	if (key->lib)
+		ocb_aes_lib::ecb_encrypt_blks(blks, nblks, key->lib);
+	else
+		AESNI::encrypt_blocks(reinterpret_cast<unsigned char *>(blks), nblks, key->schedule);
+}
+
+static void ecb_decrypt_blks(block *blks, unsigned nblks, KEY *key) {
+	if (key->lib)
+		ocb_aes_lib::ecb_decrypt_blks(blks, nblks, key->lib);
+	else
+		AESNI::decrypt_blocks(reinterpret_cast<unsigned char *>(blks), nblks, key->schedule);
+}
+
+}  // namespace ocb_aes
+
+#undef BPI
+#define BPI 8  /* Number of blocks in buffer per ECB call */
+
+#else
+namespace ocb_aes = ocb_aes_lib;
+#endif
+
 /* ----------------------------------------------------------------------- */
 /* Define OCB context structure.                                           */
 /* ----------------------------------------------------------------------- */
@@ -868,8 +948,8 @@ static void process_ad(ae_ctx *ctx, const void *ad, int ad_len, int final)
 				case 6: ad_checksum = xor_block(ad_checksum, ta[5]);
 					/* fallthrough */
 				case 5: ad_checksum = xor_block(ad_checksum, ta[4]);
-					/* fallthrough */
 				#endif
+					/* fallthrough */
 				case 4: ad_checksum = xor_block(ad_checksum, ta[3]);
 					/* fallthrough */
 				case 3: ad_checksum = xor_block(ad_checksum, ta[2]);
@@ -1043,8 +1123,8 @@ int ae_encrypt(ae_ctx     *  ctx,
 			case 5: ctp[4] = xor_block(ta[4], oa[4]);
 				/* fallthrough */
 			case 4: ctp[3] = xor_block(ta[3], oa[3]);
-				/* fallthrough */
 			#endif
+				/* fallthrough */
 			case 3: ctp[2] = xor_block(ta[2], oa[2]);
 				/* fallthrough */
 			case 2: ctp[1] = xor_block(ta[1], oa[1]);
@@ -1256,8 +1336,8 @@ int ae_decrypt(ae_ctx     *ctx,
 				    /* fallthrough */
 			case 4: ptp[3] = xor_block(ta[3], oa[3]);
 				    checksum = xor_block(checksum, ptp[3]);
-				    /* fallthrough */
 			#endif
+				    /* fallthrough */
 			case 3: ptp[2] = xor_block(ta[2], oa[2]);
 				    checksum = xor_block(checksum, ptp[2]);
 				    /* fallthrough */
@@ -1296,6 +1376,249 @@ int ae_decrypt(ae_ctx     *ctx,
     return ct_len;
  }
 
+/* ----------------------------------------------------------------------- */
+/* Batches of messages (a Mosh addition)                                   */
+/* ----------------------------------------------------------------------- */
+
+/* Each message of a batch is enciphered in place, without associated
+   data, and carries its tag after its text. A message's runs of BPI full
+   blocks go through ae_encrypt() or ae_decrypt() as they would alone. Its
+   tail -- the last few full blocks, the pad for a partial block and the
+   tag -- is gathered with those of the other messages, so that tails and
+   short messages keep the AES unit as busy as the runs do. */
+
+#define BATCH_MSGS   16  /* Messages per pass                              */
+#define SCATTER_BLKS 64  /* Gathered blocks per ECB call                   */
+
+struct scatter {
+	block *blks[SCATTER_BLKS];
+	unsigned n;
+	ocb_aes::KEY *key;
+	int decrypt;
+};
+
+static void scatter_init(struct scatter *s, ocb_aes::KEY *key, int decrypt)
+{
+	s->n = 0;
+	s->key = key;
+	s->decrypt = decrypt;
+}
+
+static void scatter_flush(struct scatter *s)
+{
+	block tmp[SCATTER_BLKS];
+	unsigned i;
+
+	for (i = 0; i < s->n; i++)
+		tmp[i] = *s->blks[i];
+	if (s->decrypt)
+		ocb_aes::ecb_decrypt_blks(tmp, s->n, s->key);
+	else
+		ocb_aes::ecb_encrypt_blks(tmp, s->n, s->key);
+	for (i = 0; i < s->n; i++)
+		*s->blks[i] = tmp[i];
+	s->n = 0;
+}
+
+static void scatter_add(struct scatter *s, block *blk)
+{
+	s->blks[s->n++] = blk;
+	if (s->n == SCATTER_BLKS)
+		scatter_flush(s);
+}
+
+/* ae_encrypt() or ae_decrypt() on a message's runs of BPI blocks, which
+   leaves its offset and checksum so far in ctx. */
+static unsigned batch_runs(ae_ctx *ctx, const void *nonce, block *p, unsigned len, int decrypt)
+{
+	union { uint32_t u32[3]; uint8_t u8[12]; } aligned;
+	const unsigned run_len = len - len % (BPI*16);
+
+	memcpy(aligned.u8, nonce, 12);
+	if (decrypt)
+		ae_decrypt(ctx, aligned.u8, p, run_len, NULL, 0, p, NULL, AE_PENDING);
+	else
+		ae_encrypt(ctx, aligned.u8, p, run_len, NULL, 0, p, NULL, AE_PENDING);
+	return run_len / 16;
+}
+
+static void encrypt_batch(ae_ctx *ctx, int n, const void * const *nonces,
+                          void * const *texts, const int *lens, int *results)
+{
+	union { uint32_t u32[4]; uint8_t u8[16]; block bl; } tmp;
+	block tail_offset[BATCH_MSGS]; /* Offset before each message's tail */
+	block extra[2*BATCH_MSGS];     /* Pad, then tag, of each message     */
+	struct scatter s;
+	unsigned i, full, remaining;
+	int m;
+	#if (OCB_TAG_LEN > 0)
+	const int tag_len = OCB_TAG_LEN;
+	#else
+	const int tag_len = ctx->tag_len;
+	#endif
+
+	scatter_init(&s, ctx->encrypt_key, 0);
+
+	for (m = 0; m < n; m++) {
+		block *p = (block *)texts[m];
+		block offset, checksum;
+
+		full = (unsigned)lens[m] / 16;
+		remaining = (unsigned)lens[m] % 16;
+		i = batch_runs(ctx, nonces[m], p, lens[m], 0);
+		tail_offset[m] = offset = ctx->offset;
+		checksum = ctx->checksum;
+
+		/* The tail, gathered */
+		for ( ; i < full; i++) {
+			offset = xor_block(offset, getL(ctx, ntz(i+1)));
+			checksum = xor_block(checksum, p[i]);
+			p[i] = xor_block(p[i], offset);
+			scatter_add(&s, p + i);
+		}
+		if (remaining) {
+			tmp.bl = zero_block();
+			memcpy(tmp.u8, p + full, remaining);
+			tmp.u8[remaining] = (unsigned char)0x80u;
+			checksum = xor_block(checksum, tmp.bl);
+			extra[2*m] = offset = xor_block(offset, ctx->Lstar);
+			scatter_add(&s, &extra[2*m]);
+		}
+		offset = xor_block(offset, ctx->Ldollar);
+		extra[2*m+1] = xor_block(offset, checksum);
+		scatter_add(&s, &extra[2*m+1]);
+	}
+	scatter_flush(&s);
+
+	/* Finish each tail, and append the tag */
+	for (m = 0; m < n; m++) {
+		block *p = (block *)texts[m];
+		block offset = tail_offset[m];
+
+		full = (unsigned)lens[m] / 16;
+		remaining = (unsigned)lens[m] % 16;
+		for (i = full - full % BPI; i < full; i++) {
+			offset = xor_block(offset, getL(ctx, ntz(i+1)));
+			p[i] = xor_block(p[i], offset);
+		}
+		if (remaining) {
+			memcpy(tmp.u8, p + full, remaining);
+			tmp.bl = xor_block(tmp.bl, extra[2*m]);
+			memcpy(p + full, tmp.u8, remaining);
+		}
+		memcpy((char *)texts[m] + lens[m], &extra[2*m+1], tag_len);
+		results[m] = lens[m] + tag_len;
+	}
+}
+
+static void decrypt_batch(ae_ctx *ctx, int n, const void * const *nonces,
+                          void * const *texts, const int *lens, int *results)
+{
+	union { uint32_t u32[4]; uint8_t u8[16]; block bl; } tmp;
+	block tail_offset[BATCH_MSGS]; /* Offset before each message's tail */
+	block checksum[BATCH_MSGS];    /* Of each message so far             */
+	block extra[2*BATCH_MSGS];     /* Pad, then tag, of each message     */
+	struct scatter s, pads;
+	unsigned i, full, remaining;
+	int m;
+	#if (OCB_TAG_LEN > 0)
+	const int tag_len = OCB_TAG_LEN;
+	#else
+	const int tag_len = ctx->tag_len;
+	#endif
+
+	scatter_init(&s, ctx->decrypt_key, 1);
+	scatter_init(&pads, ctx->encrypt_key, 0);
+
+	for (m = 0; m < n; m++) {
+		block *p = (block *)texts[m];
+		block offset;
+
+		if (lens[m] < tag_len) {
+			results[m] = AE_INVALID;
+			continue;
+		}
+		results[m] = lens[m] - tag_len;
+		full = (unsigned)results[m] / 16;
+		remaining = (unsigned)results[m] % 16;
+		i = batch_runs(ctx, nonces[m], p, results[m], 1);
+		tail_offset[m] = offset = ctx->offset;
+		checksum[m] = ctx->checksum;
+
+		/* The tail, gathered */
+		for ( ; i < full; i++) {
+			offset = xor_block(offset, getL(ctx, ntz(i+1)));
+			p[i] = xor_block(p[i], offset);
+			scatter_add(&s, p + i);
+		}
+		if (remaining) {
+			extra[2*m] = xor_block(offset, ctx->Lstar);
+			scatter_add(&pads, &extra[2*m]);
+		}
+	}
+	scatter_flush(&s);
+	scatter_flush(&pads);
+
+	/* Finish each tail, and gather the tags */
+	for (m = 0; m < n; m++) {
+		block *p = (block *)texts[m];
+		block offset = tail_offset[m];
+
+		if (results[m] < 0)
+			continue;
+		full = (unsigned)results[m] / 16;
+		remaining = (unsigned)results[m] % 16;
+		for (i = full - full % BPI; i < full; i++) {
+			offset = xor_block(offset, getL(ctx, ntz(i+1)));
+			p[i] = xor_block(p[i], offset);
+			checksum[m] = xor_block(checksum[m], p[i]);
+		}
+		if (remaining) {
+			memcpy(tmp.u8, p + full, remaining);
+			tmp.bl = xor_block(tmp.bl, extra[2*m]);
+			memcpy(p + full, tmp.u8, remaining);
+			memset(tmp.u8 + remaining, 0, 16 - remaining);
+			tmp.u8[remaining] = (unsigned char)0x80u;
+			checksum[m] = xor_block(checksum[m], tmp.bl);
+			offset = xor_block(offset, ctx->Lstar);
+		}
+		offset = xor_block(offset, ctx->Ldollar);
+		extra[2*m+1] = xor_block(offset, checksum[m]);
+		scatter_add(&pads, &extra[2*m+1]);
+	}
+	scatter_flush(&pads);
+
+	/* Compare with proposed tags */
+	for (m = 0; m < n; m++) {
+		if (results[m] < 0)
+			continue;
+		if (constant_time_memcmp((char *)texts[m] + results[m], &extra[2*m+1], tag_len) != 0)
+			results[m] = AE_INVALID;
+	}
+}
+
+int ae_encrypt_batch(ae_ctx *ctx, int n, const void * const *nonces,
+                     void * const *texts, const int *lens, int *results)
+{
+	int done;
+
+	for (done = 0; done < n; done += BATCH_MSGS)
+		encrypt_batch(ctx, n - done < BATCH_MSGS ? n - done : BATCH_MSGS,
+		              nonces + done, texts + done, lens + done, results + done);
+	return AE_SUCCESS;
+}
+
+int ae_decrypt_batch(ae_ctx *ctx, int n, const void * const *nonces,
+                     void * const *texts, const int *lens, int *results)
+{
+	int done;
+
+	for (done = 0; done < n; done += BATCH_MSGS)
+		decrypt_batch(ctx, n - done < BATCH_MSGS ? n - done : BATCH_MSGS,
+		              nonces + done, texts + done, lens + done, results + done);
+	return AE_SUCCESS;
+}
+
 /* ----------------------------------------------------------------------- */
 /* Simple test program                                                     */
 /* ----------------------------------------------------------------------- */
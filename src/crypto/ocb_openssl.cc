@@ -209,3 +209,30 @@ int ae_decrypt( ae_ctx* ctx,
   plaintext_len += len;
   return plaintext_len;
 }
+
+// OpenSSL's OCB takes one message at a time, so a batch is a loop.
+int ae_encrypt_batch( ae_ctx* ctx,
+                      int n,
+                      const void* const* nonces,
+                      void* const* texts,
+                      const int* lens,
+                      int* results )
+{
+  for ( int i = 0; i < n; i++ ) {
+    results[i] = ae_encrypt( ctx, nonces[i], texts[i], lens[i], NULL, 0, texts[i], NULL, AE_FINALIZE );
+  }
+  return AE_SUCCESS;
+}
+
+int ae_decrypt_batch( ae_ctx* ctx,
+                      int n,
+                      const void* const* nonces,
+                      void* const* texts,
+                      const int* lens,
+                      int* results )
+{
+  for ( int i = 0; i < n; i++ ) {
+    results[i] = ae_decrypt( ctx, nonces[i], texts[i], lens[i], NULL, 0, texts[i], NULL, AE_FINALIZE );
+  }
+  return AE_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#include "src/include/config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#if HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
+#if HAVE_PTHREAD_ATFORK
+#include <pthread.h>
+#endif
+
+#include "src/crypto/prng.h"
+
+static const char rdev[] = "/dev/urandom";
+
+static inline uint32_t load_le32( const unsigned char* p )
+{
+  return uint32_t( p[0] ) | ( uint32_t( p[1] ) << 8 ) | ( uint32_t( p[2] ) << 16 ) | ( uint32_t( p[3] ) << 24 );
+}
+
+static inline void store_le32( unsigned char* p, uint32_t x )
+{
+  p[0] = x;
+  p[1] = x >> 8;
+  p[2] = x >> 16;
+  p[3] = x >> 24;
+}
+
+static inline uint32_t rotl32( uint32_t x, int n )
+{
+  return ( x << n ) | ( x >> ( 32 - n ) );
+}
+
+static inline void quarter_round( uint32_t* x, int a, int b, int c, int d )
+{
+  x[a] += x[b];
+  x[d] = rotl32( x[d] ^ x[a], 16 );
+  x[c] += x[d];
+  x[b] = rotl32( x[b] ^ x[c], 12 );
+  x[a] += x[b];
+  x[d] = rotl32( x[d] ^ x[a], 8 );
+  x[c] += x[d];
+  x[b] = rotl32( x[b] ^ x[c], 7 );
+}
+
+void Crypto::chacha20_block( const uint32_t key[8],
+                             uint32_t counter,
+                             const uint32_t nonce[3],
+                             unsigned char out[64] )
+{
+  uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 }; /* "expand 32-byte k" */
+  memcpy( state + 4, key, 8 * sizeof *key );
+  state[12] = counter;
+  memcpy( state + 13, nonce, 3 * sizeof *nonce );
+
+  uint32_t x[16];
+  memcpy( x, state, sizeof x );
+
+  for ( int i = 0; i < 10; i++ ) {
+    quarter_round( x, 0, 4, 8, 12 );
+    quarter_round( x, 1, 5, 9, 13 );
+    quarter_round( x, 2, 6, 10, 14 );
+    quarter_round( x, 3, 7, 11, 15 );
+    quarter_round( x, 0, 5, 10, 15 );
+    quarter_round( x, 1, 6, 11, 12 );
+    quarter_round( x, 2, 7, 8, 13 );
+    quarter_round( x, 3, 4, 9, 14 );
+  }
+
+  for ( int i = 0; i < 16; i++ ) {
+    store_le32( out + 4 * i, x[i] + state[i] );
+  }
+}
+
+/* size bytes, at most 256, from the system's generator */
+static void system_random( unsigned char* dest, size_t size )
+{
+#if HAVE_GETRANDOM
+  while ( size > 0 ) {
+    const ssize_t got = getrandom( dest, size, 0 );
+    if ( got < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == ENOSYS ) {
+        break; /* older kernel: fall back to the device */
+      }
+      throw CryptoException( std::string( "getrandom: " ) + strerror( errno ) );
+    }
+    dest += got;
+    size -= got;
+  }
+#elif HAVE_GETENTROPY
+  if ( 0 == getentropy( dest, size ) ) {
+    return;
+  }
+#endif
+  if ( size == 0 ) {
+    return;
+  }
+
+  const int fd = open( rdev, O_RDONLY | O_CLOEXEC );
+  if ( fd < 0 ) {
+    throw CryptoException( "Could not open " + std::string( rdev ) );
+  }
+  while ( size > 0 ) {
+    const ssize_t got = read( fd, dest, size );
+    if ( got < 0 && errno == EINTR ) {
+      continue;
+    }
+    if ( got <= 0 ) {
+      close( fd );
+      throw CryptoException( "Could not read from " + std::string( rdev ) );
+    }
+    dest += got;
+    size -= got;
+  }
+  close( fd );
+}
+
+/* Differs in a child after fork() from its parent.  Where pthread_atfork()
+   registers a counter, this is read without a system call. */
+#if HAVE_PTHREAD_ATFORK
+static uint64_t forks = 0;
+
+static void count_fork( void )
+{
+  forks++;
+}
+#endif
+
+static uint64_t fork_generation( void )
+{
+#if HAVE_PTHREAD_ATFORK
+  static const bool registered = ( 0 == pthread_atfork( NULL, NULL, count_fork ) );
+  if ( registered ) {
+    return forks;
+  }
+#endif
+  return getpid();
+}
+
+PRNG::PRNG() : key(), buffer(), next( sizeof buffer ), since_reseed( 0 ), generation( 0 )
+{
+  seed();
+}
+
+PRNG::~PRNG()
+{
+  memset( key, 0, sizeof key );
+  memset( buffer, 0, sizeof buffer );
+}
+
+/* A new key from the system, discarding the buffer */
+void PRNG::seed( void )
+{
+  unsigned char fresh[sizeof key];
+  system_random( fresh, sizeof fresh );
+  for ( size_t i = 0; i < 8; i++ ) {
+    key[i] = load_le32( fresh + 4 * i );
+  }
+  memset( fresh, 0, sizeof fresh );
+  memset( buffer, 0, sizeof buffer );
+  next = sizeof buffer;
+  since_reseed = 0;
+  generation = fork_generation();
+}
+
+/* More from the system, mixed into the key */
+void PRNG::reseed( void )
+{
+  unsigned char fresh[sizeof key];
+  system_random( fresh, sizeof fresh );
+  for ( size_t i = 0; i < 8; i++ ) {
+    key[i] ^= load_le32( fresh + 4 * i );
+  }
+  memset( fresh, 0, sizeof fresh );
+  since_reseed = 0;
+}
+
+void PRNG::refill( void )
+{
+  static const uint32_t nonce[3] = { 0, 0, 0 };
+
+  if ( since_reseed >= RESEED_BYTES ) {
+    reseed();
+  }
+
+  for ( size_t i = 0; i < BUFFER_BLOCKS; i++ ) {
+    chacha20_block( key, i, nonce, buffer + 64 * i );
+  }
+  since_reseed += sizeof buffer;
+
+  /* the next key, which is not handed out */
+  for ( size_t i = 0; i < 8; i++ ) {
+    key[i] = load_le32( buffer + 4 * i );
+  }
+  memset( buffer, 0, sizeof key );
+  next = sizeof key;
+}
+
+void PRNG::fill( void* dest, size_t size )
+{
+  if ( generation != fork_generation() ) {
+    seed(); /* not the parent's stream */
+  }
+
+  unsigned char* out = static_cast<unsigned char*>( dest );
+  while ( size > 0 ) {
+    if ( next == sizeof buffer ) {
+      refill();
+    }
+    const size_t n = std::min( size, sizeof buffer - next );
+    memcpy( out, buffer + next, n );
+    memset( buffer + next, 0, n );
+    next += n;
+    out += n;
+    size -= n;
+  }
+}
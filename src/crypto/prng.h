@@ -33,43 +33,52 @@
 #ifndef PRNG_HPP
 #define PRNG_HPP
 
+#include <cstddef>
 #include <cstdint>
-#include <fstream>
-#include <string>
 
 #include "src/crypto/crypto.h"
 
-/* Read random bytes from /dev/urandom.
+using namespace Crypto;
 
-   We rely on stdio buffering for efficiency. */
+namespace Crypto {
+/* One 64-byte block of the ChaCha20 keystream (RFC 8439) */
+void chacha20_block( const uint32_t key[8], uint32_t counter, const uint32_t nonce[3], unsigned char out[64] );
+}
 
-static const char rdev[] = "/dev/urandom";
+/* Random bytes from ChaCha20, keyed from the system's generator
+   (getrandom(), getentropy() or /dev/urandom).
 
-using namespace Crypto;
+   Each refill of the buffer takes the next key from the start of the
+   keystream, so that what has been handed out cannot be recovered from
+   the state, and bytes are wiped as they are handed out.  The key is
+   drawn afresh from the system in a child after fork(), and mixed with
+   more from the system every RESEED_BYTES. */
 
 class PRNG
 {
 private:
-  std::ifstream randfile;
+  static const size_t BUFFER_BLOCKS = 16;
+  static const uint64_t RESEED_BYTES = 1 << 20;
+
+  uint32_t key[8];
+  unsigned char buffer[BUFFER_BLOCKS * 64];
+  size_t next;            /* first unread byte of buffer */
+  uint64_t since_reseed;  /* bytes of keystream */
+  uint64_t generation;    /* of fork() at seeding */
+
+  void seed( void );
+  void reseed( void );
+  void refill( void );
 
   /* unimplemented to satisfy -Weffc++ */
   PRNG( const PRNG& );
   PRNG& operator=( const PRNG& );
 
 public:
-  PRNG() : randfile( rdev, std::ifstream::in | std::ifstream::binary ) {}
+  PRNG();
+  ~PRNG();
 
-  void fill( void* dest, size_t size )
-  {
-    if ( 0 == size ) {
-      return;
-    }
-
-    randfile.read( static_cast<char*>( dest ), size );
-    if ( !randfile ) {
-      throw CryptoException( "Could not read from " + std::string( rdev ) );
-    }
-  }
+  void fill( void* dest, size_t size );
 
   uint8_t uint8()
   {
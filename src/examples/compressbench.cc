@@ -0,0 +1,227 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+/* Compares compression backends on screen diffs: either those of a
+   built-in interactive session, or of replaying a recording (e.g.
+   made with script(1)) given as the argument, a chunk at a time.
+   Each diff is compressed on its own, against the history of its
+   state with or without the built-in dictionary, and wrapped in its
+   instruction as on the wire. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/network/compressor.h"
+#include "src/protobufs/transportinstruction.pb.h"
+#include "src/statesync/completeterminal.h"
+#include "src/util/fatal_assert.h"
+
+const size_t CHUNK_SIZE = 64; /* bytes of recording per frame */
+
+using namespace Network;
+
+static std::vector<std::string> session_diffs( const std::vector<std::string>& output )
+{
+  Terminal::Complete terminal( 80, 24 );
+  terminal.set_screen_delta( true );
+  std::vector<std::string> diffs;
+  for ( std::vector<std::string>::const_iterator i = output.begin(); i != output.end(); i++ ) {
+    Terminal::Complete last( terminal );
+    terminal.act( *i );
+    diffs.push_back( terminal.diff_from( last ) );
+  }
+  return diffs;
+}
+
+static std::vector<std::string> synthetic_output( void )
+{
+  const char* commands[] = { "ls -l /usr/lib", "git log --oneline", "make -j8", "vim foo.c", "echo hello world" };
+  std::vector<std::string> output;
+  for ( int round = 0; round < 20; round++ ) {
+    for ( size_t c = 0; c < sizeof( commands ) / sizeof( commands[0] ); c++ ) {
+      output.push_back( "\033[1;32muser@host\033[0m:\033[1;34m~/src\033[0m$ " );
+      for ( const char* p = commands[c]; *p; p++ ) {
+        output.push_back( std::string( 1, *p ) );
+      }
+      for ( int k = 0; k < 10; k++ ) {
+        char line[128];
+        snprintf(
+          line, sizeof( line ), "\r\n-rw-r--r-- 1 root root %6d Jan  1 00:00 libfoo%d.so", k * 1013, k * round );
+        output.push_back( line );
+      }
+      output.push_back( "\r\n" );
+    }
+  }
+  return output;
+}
+
+static std::vector<std::string> recorded_output( const char* filename )
+{
+  std::ifstream file( filename, std::ios::binary );
+  if ( !file ) {
+    perror( filename );
+    exit( 1 );
+  }
+  std::stringstream contents;
+  contents << file.rdbuf();
+  const std::string recording = contents.str();
+
+  std::vector<std::string> output;
+  for ( size_t i = 0; i < recording.size(); i += CHUNK_SIZE ) {
+    output.push_back( recording.substr( i, CHUNK_SIZE ) );
+  }
+  return output;
+}
+
+static Compressor compressor;
+
+static size_t instruction_size( const std::string& diff, Compression method, uint32_t dictionary, uint64_t num )
+{
+  TransportBuffers::Instruction inst;
+  inst.set_protocol_version( 2 );
+  inst.set_old_num( num );
+  inst.set_new_num( num + 1 );
+  inst.set_ack_num( num );
+  inst.set_throwaway_num( num );
+  inst.set_diff( diff );
+  if ( method != COMPRESSION_NONE ) {
+    inst.set_diff_compression( method | dictionary << 4 );
+  }
+  const Compression outer = method == COMPRESSION_NONE ? COMPRESSION_ZLIB : method;
+  return compressor.compress_str( inst.SerializeAsString(), outer, dictionary ).size();
+}
+
+const size_t OPENING = 100; /* instructions at the start of a session, while the history is short */
+
+/* keystroke echoes and the like */
+static bool interactive( const std::string& diff )
+{
+  return diff.size() >= 20 && diff.size() <= 200;
+}
+
+static void measure( const std::vector<std::string>& diffs, Compression method, uint32_t dictionary )
+{
+  size_t instructions = 0, raw = 0, compressed = 0, wire = 0, interactive_instructions = 0, interactive_wire = 0;
+  size_t opening_wire = 0;
+  std::chrono::duration<double, std::micro> compress_time( 0 ), uncompress_time( 0 );
+
+  std::shared_ptr<const std::string> history = std::make_shared<const std::string>();
+  for ( size_t i = 0; i < diffs.size(); i++ ) {
+    const std::string& diff = diffs[i];
+    if ( diff.empty() ) {
+      continue;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::string packed = compressor.compress_str( diff, *history, method, dictionary );
+    std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+    const std::string unpacked = compressor.uncompress_str( packed, *history, method, dictionary );
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    fatal_assert( unpacked == diff );
+
+    compress_time += middle - start;
+    uncompress_time += end - middle;
+    const size_t size = instruction_size( packed, method, dictionary, i );
+    if ( instructions < OPENING ) {
+      opening_wire += size;
+    }
+    instructions++;
+    raw += diff.size();
+    compressed += packed.size();
+    wire += size;
+    if ( interactive( diff ) ) {
+      interactive_instructions++;
+      interactive_wire += size;
+    }
+    history = next_history( history, diff );
+  }
+
+  printf( "%-4s %-10s ratio %.3f  %5.1f bytes/instruction (%5.1f interactive, %5.1f opening)  "
+          "compress %6.1f MB/s  decompress %6.1f MB/s\n",
+          compression_name( method ),
+          dictionary ? "dictionary" : "",
+          double( compressed ) / raw,
+          double( wire ) / instructions,
+          double( interactive_wire ) / interactive_instructions,
+          double( opening_wire ) / std::min( instructions, OPENING ),
+          raw / compress_time.count(),
+          raw / uncompress_time.count() );
+}
+
+int main( int argc, char** argv )
+{
+  const std::vector<std::string> diffs
+    = session_diffs( argc > 1 ? recorded_output( argv[1] ) : synthetic_output() );
+
+  size_t instructions = 0, raw = 0, wire = 0, interactive_instructions = 0, interactive_wire = 0, opening_wire = 0;
+  for ( size_t i = 0; i < diffs.size(); i++ ) {
+    if ( diffs[i].empty() ) {
+      continue;
+    }
+    const size_t size = instruction_size( diffs[i], COMPRESSION_NONE, 0, i );
+    if ( instructions < OPENING ) {
+      opening_wire += size;
+    }
+    instructions++;
+    raw += diffs[i].size();
+    wire += size;
+    if ( interactive( diffs[i] ) ) {
+      interactive_instructions++;
+      interactive_wire += size;
+    }
+  }
+  printf( "%lu diffs (%lu interactive), %.1f bytes/diff\n",
+          (unsigned long)instructions,
+          (unsigned long)interactive_instructions,
+          double( raw ) / instructions );
+  printf( "only the instruction compressed: %5.1f bytes/instruction (%5.1f interactive, %5.1f opening)\n",
+          double( wire ) / instructions,
+          double( interactive_wire ) / interactive_instructions,
+          double( opening_wire ) / std::min( instructions, OPENING ) );
+
+  for ( int i = COMPRESSION_ZLIB; i <= COMPRESSION_LZ4; i++ ) {
+    const Compression method = Compression( i );
+    if ( compression_from_name( compression_name( method ) ) == method ) {
+      measure( diffs, method, 0 );
+      measure( diffs, method, DICTIONARY_VERSION );
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,358 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+/* Measures the cost of encrypting and decrypting one packet, at sizes from
+   16 bytes to the largest text Connection sends, through four paths: the
+   OCB code's ae_encrypt() and ae_decrypt(), Session's in-place calls one
+   at a time and in batches of Session::BATCH_MAX, as Connection uses them
+   for a burst of fragments, and Session's Message interface.  Each
+   in-place decryption starts from a fresh copy of the datagrams, which is
+   counted in its cost.  AES-128-OCB is measured with each AES
+   implementation $MOSH_AES_IMPL can choose; where the processor or the
+   build lacks one, its rows repeat whichever the OCB code falls back to.
+   The other ciphers in the build follow.
+
+   Each row gives nanoseconds, cycles per byte of text, and calls to
+   operator new, per packet.  Cycles are those of the time-stamp counter,
+   which ticks at the processor's nominal rate, and are not shown where
+   there is none.  The argument, if any, is the number of packets of each
+   size. */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER 1
+#else
+#define HAVE_CYCLE_COUNTER 0
+#endif
+
+#include "src/crypto/ae.h"
+#include "src/crypto/crypto.h"
+#include "src/util/fatal_assert.h"
+
+using namespace Crypto;
+
+static size_t allocations = 0;
+
+void* operator new( size_t size )
+{
+  allocations++;
+  void* p = malloc( size ? size : 1 );
+  if ( p == NULL ) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[]( size_t size )
+{
+  return operator new( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+  free( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+  free( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+  free( p );
+}
+
+static inline uint64_t cycles( void )
+{
+#if HAVE_CYCLE_COUNTER
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct Cost
+{
+  std::chrono::duration<double, std::nano> time;
+  uint64_t cycles;
+  size_t allocations;
+};
+
+/* Counts from its construction */
+class Meter
+{
+private:
+  std::chrono::steady_clock::time_point start_time;
+  uint64_t start_cycles;
+  size_t start_allocations;
+
+public:
+  Meter()
+    : start_time( std::chrono::steady_clock::now() ), start_cycles( cycles() ), start_allocations( allocations )
+  {}
+
+  Cost read( void ) const
+  {
+    Cost cost;
+    cost.cycles = cycles() - start_cycles;
+    cost.time = std::chrono::steady_clock::now() - start_time;
+    cost.allocations = allocations - start_allocations;
+    return cost;
+  }
+};
+
+static const size_t TEXT_OFFSET = 16;
+static const size_t TAG_LEN = 16;
+
+static void print_cost( const char* what, const Cost& cost, size_t len, int packets )
+{
+  printf( "  %s %8.1f ns", what, cost.time.count() / packets );
+  if ( HAVE_CYCLE_COUNTER ) {
+    printf( " %6.2f cycles/B", double( cost.cycles ) / packets / len );
+  } else {
+    printf( "    n/a cycles/B" );
+  }
+  printf( " %4.1f allocs", double( cost.allocations ) / packets );
+}
+
+static void report( const char* impl,
+                    Algorithm algorithm,
+                    const char* path,
+                    size_t len,
+                    int packets,
+                    const Cost& encrypt_cost,
+                    const Cost& decrypt_cost )
+{
+  printf( "%-7s %-18s %-8s %5zu B:", impl, algorithm_name( algorithm ), path, len );
+  print_cost( "encrypt", encrypt_cost, len, packets );
+  print_cost( "decrypt", decrypt_cost, len, packets );
+  printf( "\n" );
+}
+
+/* Ciphertexts kept for decryption, which each has its own nonce */
+static const int SLOTS = 16;
+
+static void measure_ae( const char* impl, size_t len, int packets )
+{
+  Base64Key key( AES_128_OCB );
+  AlignedBuffer ctx_buf( ae_ctx_sizeof() );
+  ae_ctx* ctx = (ae_ctx*)ctx_buf.data();
+  fatal_assert( ae_init( ctx, key.data(), key.len(), Nonce::NONCE_LEN, TAG_LEN ) == AE_SUCCESS );
+
+  const size_t stride = ( len + TAG_LEN + 15 ) & ~size_t( 15 );
+  AlignedBuffer nonce( Nonce::NONCE_LEN );
+  AlignedBuffer text( len );
+  AlignedBuffer ciphertexts( SLOTS * stride );
+  Nonce nonces[SLOTS];
+  memset( text.data(), 'x', len );
+
+  const Meter encrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    nonces[i % SLOTS] = Nonce( i );
+    memcpy( nonce.data(), nonces[i % SLOTS].data(), Nonce::NONCE_LEN );
+    char* ciphertext = ciphertexts.data() + ( i % SLOTS ) * stride;
+    const int ret = ae_encrypt( ctx, nonce.data(), text.data(), len, NULL, 0, ciphertext, NULL, AE_FINALIZE );
+    fatal_assert( ret == int( len + TAG_LEN ) );
+  }
+  const Cost encrypt_cost = encrypt_meter.read();
+
+  const Meter decrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    memcpy( nonce.data(), nonces[i % SLOTS].data(), Nonce::NONCE_LEN );
+    const char* ciphertext = ciphertexts.data() + ( i % SLOTS ) * stride;
+    const int ret
+      = ae_decrypt( ctx, nonce.data(), ciphertext, len + TAG_LEN, NULL, 0, text.data(), NULL, AE_FINALIZE );
+    fatal_assert( ret == int( len ) );
+  }
+  const Cost decrypt_cost = decrypt_meter.read();
+
+  fatal_assert( ae_clear( ctx ) == AE_SUCCESS );
+  report( impl, AES_128_OCB, "ae", len, packets, encrypt_cost, decrypt_cost );
+}
+
+static void measure_in_place( const char* impl, Algorithm algorithm, size_t len, int packets )
+{
+  Base64Key key( algorithm );
+  Session encryption_session( key ), decryption_session( key );
+
+  AlignedBuffer buffer( TEXT_OFFSET + len + Session::TAILROOM );
+  AlignedBuffer saved( buffer.len() );
+  char* text = buffer.data() + TEXT_OFFSET;
+  memset( text, 'x', len );
+
+  Span datagram;
+  const Meter encrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    datagram = encryption_session.encrypt_in_place( Nonce( i ), Span( text, len, TEXT_OFFSET, Session::TAILROOM ) );
+  }
+  const Cost encrypt_cost = encrypt_meter.read();
+
+  memcpy( saved.data(), buffer.data(), buffer.len() );
+  uint64_t nonce_val = 0;
+  const Meter decrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    memcpy( datagram.data, saved.data() + ( datagram.data - buffer.data() ), datagram.len );
+    decryption_session.decrypt_in_place( datagram, nonce_val );
+  }
+  const Cost decrypt_cost = decrypt_meter.read();
+  fatal_assert( nonce_val == uint64_t( packets - 1 ) );
+
+  report( impl, algorithm, "in place", len, packets, encrypt_cost, decrypt_cost );
+}
+
+static void measure_batch( const char* impl, Algorithm algorithm, size_t len, int packets )
+{
+  Base64Key key( algorithm );
+  Session encryption_session( key ), decryption_session( key );
+
+  const size_t n = Session::BATCH_MAX;
+  const size_t stride = ( TEXT_OFFSET + len + Session::TAILROOM + 15 ) & ~size_t( 15 );
+  AlignedBuffer buffer( n * stride );
+  AlignedBuffer saved( buffer.len() );
+  memset( buffer.data(), 'x', buffer.len() );
+
+  const int batches = ( packets + n - 1 ) / n;
+  Nonce nonces[Session::BATCH_MAX];
+  Span spans[Session::BATCH_MAX];
+  const Meter encrypt_meter;
+  for ( int b = 0; b < batches; b++ ) {
+    for ( size_t i = 0; i < n; i++ ) {
+      nonces[i] = Nonce( b * n + i );
+      spans[i] = Span( buffer.data() + i * stride + TEXT_OFFSET, len, TEXT_OFFSET, stride - TEXT_OFFSET - len );
+    }
+    encryption_session.encrypt_batch( n, nonces, spans );
+  }
+  const Cost encrypt_cost = encrypt_meter.read();
+
+  memcpy( saved.data(), buffer.data(), buffer.len() );
+  uint64_t nonce_vals[Session::BATCH_MAX];
+  bool ok[Session::BATCH_MAX];
+  const Meter decrypt_meter;
+  for ( int b = 0; b < batches; b++ ) {
+    for ( size_t i = 0; i < n; i++ ) {
+      char* datagram = buffer.data() + i * stride + TEXT_OFFSET - Session::HEADROOM;
+      const size_t datagram_len = Session::HEADROOM + len + Session::TAILROOM;
+      memcpy( datagram, saved.data() + ( datagram - buffer.data() ), datagram_len );
+      spans[i] = Span( datagram, datagram_len );
+    }
+    decryption_session.decrypt_batch( n, spans, nonce_vals, ok );
+  }
+  const Cost decrypt_cost = decrypt_meter.read();
+  fatal_assert( ok[n - 1] && nonce_vals[n - 1] == uint64_t( batches * n - 1 ) );
+
+  report( impl, algorithm, "batch", len, batches * n, encrypt_cost, decrypt_cost );
+}
+
+static void measure_message( const char* impl, Algorithm algorithm, size_t len, int packets )
+{
+  Base64Key key( algorithm );
+  Session encryption_session( key ), decryption_session( key );
+  const std::string text( len, 'x' );
+
+  std::string datagram;
+  const Meter encrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    datagram = encryption_session.encrypt( Message( Nonce( i ), text ) );
+  }
+  const Cost encrypt_cost = encrypt_meter.read();
+
+  uint64_t nonce_val = 0;
+  const Meter decrypt_meter;
+  for ( int i = 0; i < packets; i++ ) {
+    nonce_val = decryption_session.decrypt( datagram ).nonce.val();
+  }
+  const Cost decrypt_cost = decrypt_meter.read();
+  fatal_assert( nonce_val == uint64_t( packets - 1 ) );
+
+  report( impl, algorithm, "Message", len, packets, encrypt_cost, decrypt_cost );
+}
+
+static void measure_sizes( const char* impl, Algorithm algorithm, int packets )
+{
+  /* up to the largest text Connection puts in a 1280-byte IPv4 datagram */
+  const size_t largest = 1280 - 28 /* IPv4 and UDP headers */ - Session::HEADROOM - Session::ADDED_BYTES;
+  const size_t sizes[] = { 16, 64, 256, 512, 1024, largest };
+
+  for ( size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++ ) {
+    if ( algorithm == AES_128_OCB ) {
+      measure_ae( impl, sizes[i], packets );
+    }
+    measure_in_place( impl, algorithm, sizes[i], packets );
+    measure_batch( impl, algorithm, sizes[i], packets );
+    measure_message( impl, algorithm, sizes[i], packets );
+  }
+}
+
+int main( int argc, char** argv )
+{
+  const int packets = argc > 1 ? atoi( argv[1] ) : 100000;
+  const char* aes_impls[] = { "library", "aesni", NULL };
+
+  try {
+    for ( size_t i = 0; i < sizeof aes_impls / sizeof aes_impls[0]; i++ ) {
+      if ( aes_impls[i] ) {
+        setenv( "MOSH_AES_IMPL", aes_impls[i], 1 );
+      } else {
+        unsetenv( "MOSH_AES_IMPL" );
+      }
+      measure_sizes( aes_impls[i] ? aes_impls[i] : "default", AES_128_OCB, packets );
+    }
+
+    for ( int a = AES_128_OCB + 1; a <= CHACHA20_POLY1305; a++ ) {
+      const Algorithm algorithm = Algorithm( a );
+      if ( algorithm_from_name( algorithm_name( algorithm ) ) == ALGORITHM_NONE ) {
+        printf( "%-7s %-18s not in this build\n", "library", algorithm_name( algorithm ) );
+        continue;
+      }
+      measure_sizes( "library", algorithm, packets );
+    }
+  } catch ( const CryptoException& e ) {
+    fprintf( stderr, "Crypto exception: %s\n", e.what() );
+    return 1;
+  }
+
+  return 0;
+}
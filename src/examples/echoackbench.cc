@@ -0,0 +1,87 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+/* Measures echo-ack bookkeeping under synthetic input at 1 kHz: one
+   user input frame per millisecond, with the server loop updating the
+   echo ack and asking for the next deadline several times in between. */
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+#include "src/statesync/completeterminal.h"
+#include "src/util/fatal_assert.h"
+
+const int DURATION_MS = 10000000; /* simulated */
+const int LOOPS_PER_MS = 4;
+
+using namespace Terminal;
+
+int main( int argc, char** argv )
+{
+  int duration = DURATION_MS;
+  if ( argc > 1 ) {
+    duration = atoi( argv[1] );
+    if ( duration < 1 ) {
+      fprintf( stderr, "bogus duration\n" );
+      exit( 1 );
+    }
+  }
+
+  Complete terminal( 80, 24 );
+  uint64_t frame = 0, acks = 0, waits = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for ( uint64_t now = 1000; now < uint64_t( 1000 + duration ); now++ ) {
+    terminal.register_input_frame( ++frame, now );
+    for ( int i = 0; i < LOOPS_PER_MS; i++ ) {
+      if ( terminal.set_echo_ack( now ) ) {
+        acks++;
+      }
+      if ( terminal.wait_time( now ) != INT_MAX ) {
+        waits++;
+      }
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+  printf( "%llu input frames, %llu echo acks, %.1f ns per frame, %.1f ns per server loop\n",
+          (unsigned long long)frame,
+          (unsigned long long)acks,
+          elapsed.count() / frame,
+          elapsed.count() / ( frame * LOOPS_PER_MS ) );
+  fatal_assert( waits > 0 );
+
+  return 0;
+}
@@ -41,7 +41,6 @@
 #include <cstring>
 #include <ctime>
 #include <sstream>
-#include <typeinfo>
 
 #include <err.h>
 #include <fcntl.h>
@@ -430,13 +429,51 @@ static int run_server( const char* desired_ip,
 
   /* open parser and terminal */
   Terminal::Complete terminal( window_size.ws_col, window_size.ws_row );
+  terminal.enable_journal();
+
+  /* optionally compute updates of large frames on several threads */
+  char* display_threads_envar = getenv( "MOSH_DISPLAY_THREADS" );
+  if ( display_threads_envar && *display_threads_envar ) {
+    terminal.set_display_threads( atoi( display_threads_envar ) );
+  }
+
+  /* optionally encrypt with another cipher, named in the key we print */
+  Crypto::Algorithm algorithm = Crypto::AES_128_OCB;
+  char* aead_envar = getenv( "MOSH_AEAD" );
+  if ( aead_envar && *aead_envar ) {
+    algorithm = Crypto::algorithm_from_name( aead_envar );
+    if ( algorithm == Crypto::ALGORITHM_NONE ) {
+      fprintf( stderr, "MOSH_AEAD=%s is not available, using the default.\n", aead_envar );
+      algorithm = Crypto::AES_128_OCB;
+    }
+  }
 
   /* open network */
   Network::UserStream blank;
   using NetworkPointer = std::shared_ptr<ServerConnection>;
-  NetworkPointer network( new ServerConnection( terminal, blank, desired_ip, desired_port ) );
+  NetworkPointer network( new ServerConnection( terminal, blank, desired_ip, desired_port, algorithm ) );
 
   network->set_verbose( verbose );
+
+  /* we can decompress user input compressed against the history of its state */
+  network->set_features( Network::FEATURE_HISTORY | Network::compression_features() );
+
+  /* optionally prefer another compression backend, if the client has it */
+  char* compression_envar = getenv( "MOSH_COMPRESSION" );
+  if ( compression_envar && *compression_envar ) {
+    Network::Compression compression = Network::compression_from_name( compression_envar );
+    if ( compression == Network::COMPRESSION_NONE ) {
+      fprintf( stderr, "MOSH_COMPRESSION=%s is not available, using the default.\n", compression_envar );
+    } else {
+      network->set_compression( compression );
+    }
+  }
+
+  /* optionally let the kernel segment and coalesce our datagrams */
+  char* offload_envar = getenv( "MOSH_UDP_OFFLOAD" );
+  if ( offload_envar && *offload_envar ) {
+    network->set_udp_offload( true );
+  }
   Select::set_verbose( verbose );
 
   /*
@@ -675,6 +712,44 @@ static int run_server( const char* desired_ip,
   return 0;
 }
 
+/* longest time to hold back updates while the application draws a synchronized update */
+static const uint64_t SYNC_UPDATE_TIMEOUT = 250; /* ms */
+
+/* Update the client with the new state of the terminal, unless the
+   application is in the middle of a synchronized update (DEC private
+   mode 2026), in which case wait for it to finish or time out. */
+static void update_client_state( Terminal::Complete& terminal,
+                                 ServerConnection& network,
+                                 bool& terminal_changed,
+                                 uint64_t& sync_update_start,
+                                 uint64_t now )
+{
+  if ( network.shutdown_in_progress() ) {
+    /* the client gets no more states, so there is nothing to wait for */
+    terminal_changed = false;
+    sync_update_start = -1;
+    return;
+  }
+
+  if ( !terminal_changed ) {
+    return;
+  }
+
+  if ( terminal.get_fb().ds.synchronized_output ) {
+    if ( sync_update_start == uint64_t( -1 ) ) {
+      sync_update_start = now;
+    }
+    if ( now - sync_update_start < SYNC_UPDATE_TIMEOUT ) {
+      return;
+    }
+  } else {
+    sync_update_start = -1;
+  }
+
+  network.set_current_state( terminal );
+  terminal_changed = false;
+}
+
 static void serve( int host_fd,
                    int pipe_fd,
                    Terminal::Complete& terminal,
@@ -712,6 +787,11 @@ static void serve( int host_fd,
 
   bool child_released = false;
 
+  /* terminal has changed since the client's state was last updated */
+  bool terminal_changed = false;
+  /* when the application began its current synchronized update */
+  uint64_t sync_update_start = -1;
+
   while ( true ) {
     try {
       static const uint64_t timeout_if_no_client = 60000;
@@ -720,6 +800,11 @@ static void serve( int host_fd,
 
       timeout = std::min( timeout, network.wait_time() );
       timeout = std::min( timeout, terminal.wait_time( now ) );
+      if ( terminal_changed && sync_update_start != uint64_t( -1 ) && !network.shutdown_in_progress() ) {
+        uint64_t sync_update_deadline = sync_update_start + SYNC_UPDATE_TIMEOUT;
+        timeout
+          = std::min( timeout, sync_update_deadline > now ? static_cast<int>( sync_update_deadline - now ) : 0 );
+      }
       if ( ( !network.get_remote_state_num() ) || network.shutdown_in_progress() ) {
         timeout = std::min( timeout, 5000 );
       }
@@ -762,6 +847,10 @@ static void serve( int host_fd,
         /* packet received from the network */
         network.recv();
 
+        /* send structured screen updates, and digests to check them, if the client can use them */
+        terminal.set_screen_delta( network.get_remote_features() & Network::FEATURE_SCREEN_DELTA );
+        terminal.set_digest( network.get_remote_features() & Network::FEATURE_DIGEST );
+
         /* is new user input available for the terminal? */
         if ( network.get_remote_state_num() != last_remote_num ) {
           last_remote_num = network.get_remote_state_num();
@@ -769,31 +858,37 @@ static void serve( int host_fd,
           Network::UserStream us;
           us.apply_string( network.get_remote_diff() );
           /* apply userstream to terminal */
-          for ( size_t i = 0; i < us.size(); i++ ) {
-            const Parser::Action& action = us.get_action( i );
-            if ( typeid( action ) == typeid( Parser::Resize ) ) {
-              /* apply only the last consecutive Resize action */
-              if ( i < us.size() - 1 ) {
-                const Parser::Action& next = us.get_action( i + 1 );
-                if ( typeid( next ) == typeid( Parser::Resize ) ) {
-                  continue;
-                }
-              }
-              /* tell child process of resize */
-              const Parser::Resize& res = static_cast<const Parser::Resize&>( action );
-              struct winsize window_size;
-              if ( ioctl( host_fd, TIOCGWINSZ, &window_size ) < 0 ) {
-                perror( "ioctl TIOCGWINSZ" );
-                network.start_shutdown();
-              }
-              window_size.ws_col = res.width;
-              window_size.ws_row = res.height;
-              if ( ioctl( host_fd, TIOCSWINSZ, &window_size ) < 0 ) {
-                perror( "ioctl TIOCSWINSZ" );
+          for ( size_t i = 0; i <= us.resize_count(); i++ ) {
+            terminal.act_keystrokes( us.get_keystrokes( i ), terminal_to_host );
+            if ( i == us.resize_count() ) {
+              break;
+            }
+
+            /* apply only the last consecutive Resize action */
+            if ( ( i + 1 < us.resize_count() ) && !us.has_keystrokes( i + 1 ) ) {
+              continue;
+            }
+            /* the keystrokes before a resize reach the child process before it */
+            if ( !terminal_to_host.empty() ) {
+              if ( swrite( host_fd, terminal_to_host.c_str(), terminal_to_host.length() ) < 0 ) {
                 network.start_shutdown();
               }
+              terminal_to_host.clear();
             }
-            terminal_to_host += terminal.act( action );
+            /* tell child process of resize */
+            const Parser::Resize& res = us.get_resize( i );
+            struct winsize window_size;
+            if ( ioctl( host_fd, TIOCGWINSZ, &window_size ) < 0 ) {
+              perror( "ioctl TIOCGWINSZ" );
+              network.start_shutdown();
+            }
+            window_size.ws_col = res.width;
+            window_size.ws_row = res.height;
+            if ( ioctl( host_fd, TIOCSWINSZ, &window_size ) < 0 ) {
+              perror( "ioctl TIOCSWINSZ" );
+              network.start_shutdown();
+            }
+            terminal_to_host += terminal.act( res );
           }
 
           if ( !us.empty() ) {
@@ -802,9 +897,8 @@ static void serve( int host_fd,
           }
 
           /* update client with new state of terminal */
-          if ( !network.shutdown_in_progress() ) {
-            network.set_current_state( terminal );
-          }
+          terminal_changed = true;
+          update_client_state( terminal, network, terminal_changed, sync_update_start, now );
 #if defined( HAVE_SYSLOG ) || defined( HAVE_UTEMPTER )
 #ifdef HAVE_UTEMPTER
           if ( !connected_utmp ) {
@@ -874,10 +968,12 @@ static void serve( int host_fd,
           terminal_to_host += terminal.act( std::string( buf, bytes_read ) );
 
           /* update client with new state of terminal */
-          network.set_current_state( terminal );
+          terminal_changed = true;
         }
       }
 
+      update_client_state( terminal, network, terminal_changed, sync_update_start, now );
+
       /* write user input and terminal writeback to the host */
       if ( swrite( host_fd, terminal_to_host.c_str(), terminal_to_host.length() ) < 0 ) {
         network.start_shutdown();
@@ -935,9 +1031,10 @@ static void serve( int host_fd,
       }
 #endif
 
-      if ( terminal.set_echo_ack( now ) && !network.shutdown_in_progress() ) {
+      if ( terminal.set_echo_ack( now ) ) {
         /* update client with new echo ack */
-        network.set_current_state( terminal );
+        terminal_changed = true;
+        update_client_state( terminal, network, terminal_changed, sync_update_start, now );
       }
 
       if ( !network.get_remote_state_num() && time_since_remote_state >= timeout_if_no_client ) {
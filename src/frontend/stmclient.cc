@@ -122,6 +122,13 @@ void STMClient::init( void )
   /* Put terminal in application-cursor-key mode */
   swrite( STDOUT_FILENO, display.open().c_str() );
 
+  /* If terminfo doesn't say, ask the terminal (DECRQM) whether it supports
+     synchronized output.  The reply arrives with the user's input. */
+  if ( !display.get_sync() ) {
+    swrite( STDOUT_FILENO, "\033[?2026$p" );
+    sync_query_deadline = timestamp() + 2000;
+  }
+
   /* Add our name to window title */
   if ( !getenv( "MOSH_TITLE_NOPREFIX" ) ) {
     overlays.set_title_prefix( std::wstring( L"[mosh] " ) );
@@ -264,6 +271,17 @@ void STMClient::main_init( void )
 
   network->set_send_delay( 1 ); /* minimal delay on outgoing keystrokes */
 
+  /* optionally let the kernel segment and coalesce our datagrams */
+  const char* offload_envar = getenv( "MOSH_UDP_OFFLOAD" );
+  if ( offload_envar && *offload_envar ) {
+    network->set_udp_offload( true );
+  }
+
+  /* we can apply structured screen updates, check them against the server's digest,
+     and decompress them against the history of their state with any backend built in */
+  network->set_features( Network::FEATURE_SCREEN_DELTA | Network::FEATURE_DIGEST | Network::FEATURE_HISTORY
+                         | Network::compression_features() );
+
   /* tell server the size of the terminal */
   network->get_current_state().push_back( Parser::Resize( window_size.ws_col, window_size.ws_row ) );
 
@@ -285,7 +303,8 @@ void STMClient::output_new_frame( void )
   overlays.apply( new_state );
 
   /* calculate minimal difference from where we are */
-  const std::string diff( display.new_frame( !repaint_requested, local_framebuffer, new_state ) );
+  const std::string diff(
+    display.synchronized( display.new_frame( !repaint_requested, local_framebuffer, new_state ) ) );
   swrite( STDOUT_FILENO, diff.data(), diff.size() );
 
   repaint_requested = false;
@@ -312,13 +331,26 @@ bool STMClient::process_user_input( int fd )
   const int buf_size = 16384;
   char buf[buf_size];
 
-  /* fill buffer if possible */
-  ssize_t bytes_read = read( fd, buf, buf_size );
-  if ( bytes_read == 0 ) { /* EOF */
-    return false;
-  } else if ( bytes_read < 0 ) {
-    perror( "read" );
-    return false;
+  /* what was held back as the possible start of the query reply comes first */
+  const ssize_t held = sync_query_held.size();
+  memcpy( buf, sync_query_held.data(), held );
+  sync_query_held.clear();
+
+  /* fill buffer if possible, unless only letting go of what was held */
+  ssize_t bytes_read = 0;
+  if ( fd >= 0 ) {
+    bytes_read = read( fd, buf + held, buf_size - held );
+    if ( bytes_read == 0 ) { /* EOF */
+      return false;
+    } else if ( bytes_read < 0 ) {
+      perror( "read" );
+      return false;
+    }
+  }
+  bytes_read += held;
+
+  if ( sync_query_deadline ) {
+    bytes_read = strip_sync_query_reply( buf, bytes_read );
   }
 
   NetworkType& net = *network;
@@ -407,6 +439,54 @@ bool STMClient::process_user_input( int fd )
   return true;
 }
 
+/* Remove the terminal's reply to our synchronized-output query from the
+   user's input, and use synchronized output if the mode is recognized.
+   A trailing start of the reply is held back until the next read, and
+   let go if the rest has not come by the deadline. */
+ssize_t STMClient::strip_sync_query_reply( char* buf, ssize_t len )
+{
+  static const char reply_prefix[] = "\033[?2026;";
+  const size_t prefix_len = sizeof( reply_prefix ) - 1;
+  const size_t reply_len = prefix_len + 3;
+
+  if ( timestamp() > sync_query_deadline ) {
+    sync_query_deadline = 0;
+    return len;
+  }
+
+  for ( ssize_t i = 0; i + ssize_t( reply_len ) <= len; i++ ) {
+    if ( memcmp( buf + i, reply_prefix, prefix_len ) ) {
+      continue;
+    }
+    const char* status = buf + i + prefix_len;
+    if ( status[1] != '$' || status[2] != 'y' ) {
+      continue;
+    }
+
+    /* 1 = set, 2 = reset, 0 = not recognized, 4 = permanently reset */
+    display.set_sync( status[0] == '1' || status[0] == '2' );
+    sync_query_deadline = 0;
+
+    memmove( buf + i, buf + i + reply_len, len - i - reply_len );
+    return len - reply_len;
+  }
+
+  for ( ssize_t i = std::max( len - ssize_t( reply_len ) + 1, ssize_t( 0 ) ); i < len; i++ ) {
+    const size_t tail = len - i;
+    const size_t compared = std::min( tail, prefix_len );
+    if ( memcmp( buf + i, reply_prefix, compared ) ) {
+      continue;
+    }
+    if ( tail > prefix_len + 1 && buf[i + prefix_len + 1] != '$' ) {
+      continue;
+    }
+    sync_query_held.assign( buf + i, tail );
+    return i;
+  }
+
+  return len;
+}
+
 bool STMClient::process_resize( void )
 {
   /* get new size */
@@ -458,6 +538,12 @@ bool STMClient::main( void )
         wait_time = std::min( 250, wait_time );
       }
 
+      /* let go of a held start of the query reply at the deadline */
+      if ( !sync_query_held.empty() ) {
+        const uint64_t now = timestamp();
+        wait_time = ( now > sync_query_deadline ) ? 0 : std::min( wait_time, int( sync_query_deadline - now + 1 ) );
+      }
+
       /* poll for events */
       /* network->fd() can in theory change over time */
       sel.clear_fds();
@@ -487,8 +573,11 @@ bool STMClient::main( void )
         process_network_input();
       }
 
-      if ( sel.read( STDIN_FILENO )
-           && !process_user_input( STDIN_FILENO ) ) { /* input from the user needs to be fed to the network */
+      /* input from the user needs to be fed to the network, as does a
+         held start of the query reply whose rest never came */
+      const bool user_input = sel.read( STDIN_FILENO );
+      if ( ( user_input || ( !sync_query_held.empty() && timestamp() > sync_query_deadline ) )
+           && !process_user_input( user_input ? STDIN_FILENO : -1 ) ) {
         if ( !network->has_remote_addr() ) {
           break;
         } else if ( !network->shutdown_in_progress() ) {
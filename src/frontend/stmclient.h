@@ -73,10 +73,15 @@ private:
   bool clean_shutdown;
   unsigned int verbose;
 
+  /* until when to look for the reply to our synchronized-output query */
+  uint64_t sync_query_deadline;
+  std::string sync_query_held; /* what may be the start of the reply, held back from the user's input */
+
   void main_init( void );
   void process_network_input( void );
   bool process_user_input( int fd );
   bool process_resize( void );
+  ssize_t strip_sync_query_reply( char* buf, ssize_t len );
 
   void output_new_frame( void );
 
@@ -100,7 +105,7 @@ public:
       saved_termios(), raw_termios(), window_size(), local_framebuffer( 1, 1 ), new_state( 1, 1 ), overlays(),
       network(), display( true ) /* use TERM environment var to initialize display */, connecting_notification(),
       repaint_requested( false ), lf_entered( false ), quit_sequence_started( false ), clean_shutdown( false ),
-      verbose( s_verbose )
+      verbose( s_verbose ), sync_query_deadline( 0 ), sync_query_held()
   {
     if ( predict_mode ) {
       if ( !strcmp( predict_mode, "always" ) ) {
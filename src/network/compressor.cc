@@ -30,32 +30,416 @@
     also delete it here.
 */
 
+#include <algorithm>
+#include <cstring>
+
 #include <zlib.h>
 
 #include "compressor.h"
+#include "network.h"
 #include "src/util/dos_assert.h"
+#include "src/util/fatal_assert.h"
 
 using namespace Network;
 
-std::string Compressor::compress_str( const std::string& input )
+/* Outside zlib streams, whose first byte always has a low nibble of 8
+   and whose first two bytes are a multiple of 31. */
+static const unsigned char ZSTD_FRAME_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+static const char LZ4_BLOCK_TAG = 'L';
+static const unsigned char DICTIONARY_TAG = 0xd0; /* | version, before raw deflate */
+
+static const int ZSTD_LEVEL = 1;
+static const int LZ4_ACCELERATION = 1;
+
+static const char* const compression_names[] = { "none", "zlib", "zstd", "lz4" };
+
+static uint32_t compression_feature( Compression method )
 {
-  long unsigned int len = BUFFER_SIZE;
-  dos_assert( Z_OK
-              == compress( buffer, &len, reinterpret_cast<const unsigned char*>( input.data() ), input.size() ) );
-  return std::string( reinterpret_cast<char*>( buffer ), len );
+  switch ( method ) {
+    case COMPRESSION_ZSTD:
+      return FEATURE_ZSTD;
+    case COMPRESSION_LZ4:
+      return FEATURE_LZ4;
+    default:
+      return 0;
+  }
+}
+
+uint32_t Network::compression_features( void )
+{
+  uint32_t features = FEATURE_DICTIONARY;
+#ifdef HAVE_ZSTD
+  features |= FEATURE_ZSTD;
+#endif
+#ifdef HAVE_LZ4
+  features |= FEATURE_LZ4;
+#endif
+  return features;
+}
+
+Compression Network::compression_from_name( const char* name )
+{
+  for ( int i = COMPRESSION_ZLIB; i <= COMPRESSION_LZ4; i++ ) {
+    const Compression method = Compression( i );
+    if ( 0 == strcmp( name, compression_names[i] )
+         && ( method == COMPRESSION_ZLIB || ( compression_features() & compression_feature( method ) ) ) ) {
+      return method;
+    }
+  }
+  return COMPRESSION_NONE;
+}
+
+const char* Network::compression_name( Compression method )
+{
+  fatal_assert( method >= COMPRESSION_NONE && method <= COMPRESSION_LZ4 );
+  return compression_names[method];
 }
 
-std::string Compressor::uncompress_str( const std::string& input )
+Compression Network::negotiate_compression( Compression preferred, uint32_t remote_features )
+{
+  const uint32_t feature = compression_feature( preferred );
+  if ( feature && ( compression_features() & remote_features & feature ) ) {
+    return preferred;
+  }
+  return COMPRESSION_ZLIB;
+}
+
+Compressor::Compressor()
+  : deflater(), inflater(), deflater_ready( false ), inflater_ready( false ), primed()
+#ifdef HAVE_ZSTD
+    , zstd_compressor( NULL ), zstd_decompressor( NULL )
+#endif
+#ifdef HAVE_LZ4
+    , lz4_stream( NULL )
+#endif
+{}
+
+Compressor::~Compressor()
 {
-  long unsigned int len = BUFFER_SIZE;
+  if ( deflater_ready ) {
+    deflateEnd( &deflater );
+  }
+  if ( inflater_ready ) {
+    inflateEnd( &inflater );
+  }
+#ifdef HAVE_ZSTD
+  ZSTD_freeCCtx( zstd_compressor );
+  ZSTD_freeDCtx( zstd_decompressor );
+#endif
+#ifdef HAVE_LZ4
+  LZ4_freeStream( lz4_stream );
+#endif
+}
+
+std::string Compressor::compress_str( const std::string& input, Compression method, uint32_t dictionary )
+{
+  fatal_assert( dictionary <= DICTIONARY_VERSION && dictionary < 0x10 );
+  std::string output;
+  switch ( method ) {
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      zstd_compress( input, std::string(), output );
+      return output;
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4:
+      output.assign( 1, LZ4_BLOCK_TAG );
+      lz4_compress( input, std::string(), output );
+      return output;
+#endif
+    default:
+      break;
+  }
+
+  fatal_assert( method == COMPRESSION_ZLIB );
+  if ( dictionary ) {
+    output.assign( 1, char( DICTIONARY_TAG | dictionary ) );
+    zlib_compress( input, prime( std::string(), dictionary ), output );
+    return output;
+  }
+
+  long unsigned int len = compressBound( input.size() );
+  output.resize( len );
   dos_assert( Z_OK
-              == uncompress( buffer, &len, reinterpret_cast<const unsigned char*>( input.data() ), input.size() ) );
-  return std::string( reinterpret_cast<char*>( buffer ), len );
+              == compress( reinterpret_cast<unsigned char*>( &output[0] ),
+                           &len,
+                           reinterpret_cast<const unsigned char*>( input.data() ),
+                           input.size() ) );
+  output.resize( len );
+  return output;
+}
+
+std::string Compressor::uncompress_str( const char* input, size_t size )
+{
+  std::string output;
+#ifdef HAVE_ZSTD
+  if ( size >= sizeof( ZSTD_FRAME_MAGIC ) && 0 == memcmp( input, ZSTD_FRAME_MAGIC, sizeof( ZSTD_FRAME_MAGIC ) ) ) {
+    zstd_uncompress( input, size, std::string(), output );
+    return output;
+  }
+#endif
+#ifdef HAVE_LZ4
+  if ( size > 0 && input[0] == LZ4_BLOCK_TAG ) {
+    lz4_uncompress( input + 1, size - 1, std::string(), output );
+    return output;
+  }
+#endif
+  const unsigned char tag = size > 0 ? input[0] : 0;
+  if ( ( tag & 0xf0 ) == DICTIONARY_TAG ) {
+    const uint32_t dictionary = tag & 0x0f;
+    dos_assert( dictionary && dictionary <= DICTIONARY_VERSION );
+    zlib_uncompress( input + 1, size - 1, prime( std::string(), dictionary ), true, output );
+    return output;
+  }
+
+  zlib_uncompress( input, size, std::string(), false, output );
+  return output;
 }
 
-/* construct on first use */
-Compressor& Network::get_compressor( void )
+/* A history too short to be of much use, such as the first few,
+   follows as much of the end of the built-in dictionary as fits. */
+const std::string& Compressor::prime( const std::string& history, uint32_t dictionary )
 {
-  static Compressor the_compressor;
-  return the_compressor;
+  const std::string& builtin = builtin_dictionary( dictionary );
+  if ( builtin.empty() || history.size() >= HISTORY_SIZE ) {
+    return history;
+  }
+  const size_t size = HISTORY_SIZE, keep = std::min( builtin.size(), size - history.size() );
+  primed.assign( builtin, builtin.size() - keep, keep );
+  primed.append( history );
+  return primed;
+}
+
+std::string Compressor::compress_str( const std::string& input,
+                                      const std::string& history,
+                                      Compression method,
+                                      uint32_t dictionary )
+{
+  fatal_assert( dictionary <= DICTIONARY_VERSION );
+  const std::string& start = prime( history, dictionary );
+
+  std::string output;
+  switch ( method ) {
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      zstd_compress( input, start, output );
+      break;
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4:
+      lz4_compress( input, start, output );
+      break;
+#endif
+    default:
+      fatal_assert( method == COMPRESSION_ZLIB );
+      zlib_compress( input, start, output );
+      break;
+  }
+  return output;
+}
+
+std::string Compressor::uncompress_str( const std::string& input,
+                                        const std::string& history,
+                                        Compression method,
+                                        uint32_t dictionary )
+{
+  dos_assert( dictionary <= DICTIONARY_VERSION );
+  const std::string& start = prime( history, dictionary );
+
+  std::string output;
+  switch ( method ) {
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      zstd_uncompress( input.data(), input.size(), start, output );
+      break;
+#endif
+#ifdef HAVE_LZ4
+    case COMPRESSION_LZ4:
+      lz4_uncompress( input.data(), input.size(), start, output );
+      break;
+#endif
+    default:
+      dos_assert( method == COMPRESSION_ZLIB );
+      zlib_uncompress( input.data(), input.size(), start, true, output );
+      break;
+  }
+  return output;
+}
+
+/* a first guess at the size of what input expands to */
+static size_t initial_output_size( size_t size )
+{
+  return std::min( std::max( 8 * size, size_t( 1024 ) ), size_t( Compressor::MAX_UNCOMPRESSED ) );
+}
+
+/* Raw deflate, with a window just big enough for the history */
+void Compressor::zlib_compress( const std::string& input, const std::string& history, std::string& output )
+{
+  if ( !deflater_ready ) {
+    const int level = Z_DEFAULT_COMPRESSION, window_bits = -HISTORY_BITS, mem_level = 5;
+    dos_assert( Z_OK == deflateInit2( &deflater, level, Z_DEFLATED, window_bits, mem_level, Z_DEFAULT_STRATEGY ) );
+    deflater_ready = true;
+  } else {
+    dos_assert( Z_OK == deflateReset( &deflater ) );
+  }
+
+  if ( !history.empty() ) {
+    dos_assert( Z_OK
+                == deflateSetDictionary(
+                  &deflater, reinterpret_cast<const unsigned char*>( history.data() ), history.size() ) );
+  }
+
+  const size_t offset = output.size();
+  output.resize( offset + deflateBound( &deflater, input.size() ) );
+  deflater.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>( input.data() ) );
+  deflater.avail_in = input.size();
+  deflater.next_out = reinterpret_cast<unsigned char*>( &output[offset] );
+  deflater.avail_out = output.size() - offset;
+  dos_assert( Z_STREAM_END == deflate( &deflater, Z_FINISH ) );
+  output.resize( output.size() - deflater.avail_out );
+}
+
+/* Raw deflate, or a zlib stream.  One inflater, with the largest
+   window, reads both. */
+void Compressor::zlib_uncompress( const char* input,
+                                  size_t size,
+                                  const std::string& history,
+                                  bool raw,
+                                  std::string& output )
+{
+  const int window_bits = raw ? -MAX_WBITS : MAX_WBITS;
+  if ( !inflater_ready ) {
+    dos_assert( Z_OK == inflateInit2( &inflater, window_bits ) );
+    inflater_ready = true;
+  } else {
+    dos_assert( Z_OK == inflateReset2( &inflater, window_bits ) );
+  }
+
+  if ( !history.empty() ) {
+    dos_assert( Z_OK
+                == inflateSetDictionary(
+                  &inflater, reinterpret_cast<const unsigned char*>( history.data() ), history.size() ) );
+  }
+
+  inflater.next_in = reinterpret_cast<unsigned char*>( const_cast<char*>( input ) );
+  inflater.avail_in = size;
+  output.resize( initial_output_size( size ) );
+  size_t len = 0;
+  while ( true ) {
+    inflater.next_out = reinterpret_cast<unsigned char*>( &output[len] );
+    inflater.avail_out = output.size() - len;
+    const int ret = inflate( &inflater, Z_FINISH );
+    len = output.size() - inflater.avail_out;
+    if ( ret == Z_STREAM_END ) {
+      break;
+    }
+    /* only running out of room is worth another try */
+    dos_assert( ( ret == Z_OK || ret == Z_BUF_ERROR ) && inflater.avail_out == 0 );
+    dos_assert( output.size() < MAX_UNCOMPRESSED );
+    output.resize( std::min( 2 * output.size(), size_t( MAX_UNCOMPRESSED ) ) );
+  }
+  output.resize( len );
+}
+
+#ifdef HAVE_ZSTD
+/* The history is referenced as a prefix, which zstd forgets after one frame. */
+void Compressor::zstd_compress( const std::string& input, const std::string& history, std::string& output )
+{
+  if ( !zstd_compressor ) {
+    zstd_compressor = ZSTD_createCCtx();
+    fatal_assert( zstd_compressor );
+    fatal_assert( !ZSTD_isError( ZSTD_CCtx_setParameter( zstd_compressor, ZSTD_c_compressionLevel, ZSTD_LEVEL ) ) );
+  }
+
+  fatal_assert( !ZSTD_isError( ZSTD_CCtx_reset( zstd_compressor, ZSTD_reset_session_only ) ) );
+  if ( !history.empty() ) {
+    fatal_assert( !ZSTD_isError( ZSTD_CCtx_refPrefix( zstd_compressor, history.data(), history.size() ) ) );
+  }
+
+  const size_t offset = output.size();
+  output.resize( offset + ZSTD_compressBound( input.size() ) );
+  const size_t len = ZSTD_compress2(
+    zstd_compressor, &output[offset], output.size() - offset, input.data(), input.size() );
+  dos_assert( !ZSTD_isError( len ) );
+  output.resize( offset + len );
+}
+
+/* Frames carry their uncompressed size. */
+void Compressor::zstd_uncompress( const char* input, size_t size, const std::string& history, std::string& output )
+{
+  if ( !zstd_decompressor ) {
+    zstd_decompressor = ZSTD_createDCtx();
+    fatal_assert( zstd_decompressor );
+  }
+
+  fatal_assert( !ZSTD_isError( ZSTD_DCtx_reset( zstd_decompressor, ZSTD_reset_session_only ) ) );
+  if ( !history.empty() ) {
+    fatal_assert( !ZSTD_isError( ZSTD_DCtx_refPrefix( zstd_decompressor, history.data(), history.size() ) ) );
+  }
+
+  const unsigned long long expected = ZSTD_getFrameContentSize( input, size );
+  dos_assert( expected != ZSTD_CONTENTSIZE_UNKNOWN && expected != ZSTD_CONTENTSIZE_ERROR );
+  dos_assert( expected <= MAX_UNCOMPRESSED );
+  output.resize( expected );
+  const size_t len = ZSTD_decompressDCtx( zstd_decompressor, &output[0], output.size(), input, size );
+  dos_assert( !ZSTD_isError( len ) && len == expected );
+}
+#endif
+
+#ifdef HAVE_LZ4
+/* Loading the history (even an empty one) also resets the stream. */
+void Compressor::lz4_compress( const std::string& input, const std::string& history, std::string& output )
+{
+  if ( !lz4_stream ) {
+    lz4_stream = LZ4_createStream();
+    fatal_assert( lz4_stream );
+  }
+
+  LZ4_loadDict( lz4_stream, history.data(), history.size() );
+  const size_t offset = output.size();
+  output.resize( offset + LZ4_compressBound( input.size() ) );
+  const int len = LZ4_compress_fast_continue(
+    lz4_stream, input.data(), &output[offset], input.size(), output.size() - offset, LZ4_ACCELERATION );
+  dos_assert( len > 0 );
+  output.resize( offset + len );
+}
+
+/* Blocks don't carry their uncompressed size, so grow the output
+   until one fits, up to the most LZ4 can expand what there is. */
+void Compressor::lz4_uncompress( const char* input, size_t size, const std::string& history, std::string& output )
+{
+  dos_assert( size < MAX_UNCOMPRESSED );
+  const size_t limit = std::min( 255 * size + 16, size_t( MAX_UNCOMPRESSED ) );
+  output.resize( std::min( initial_output_size( size ), limit ) );
+  while ( true ) {
+    const int len = LZ4_decompress_safe_usingDict(
+      input, &output[0], size, output.size(), history.data(), history.size() );
+    if ( len >= 0 ) {
+      output.resize( len );
+      return;
+    }
+    dos_assert( output.size() < limit );
+    output.resize( std::min( 2 * output.size(), limit ) );
+  }
+}
+#endif
+
+std::shared_ptr<const std::string> Network::next_history( const std::shared_ptr<const std::string>& history,
+                                                          const std::string& diff )
+{
+  if ( diff.empty() ) {
+    return history;
+  }
+
+  const size_t size = Compressor::HISTORY_SIZE;
+  std::string ret;
+  if ( diff.size() < size ) {
+    const size_t keep = std::min( history->size(), size - diff.size() );
+    ret.reserve( keep + diff.size() );
+    ret.assign( *history, history->size() - keep, keep );
+    ret += diff;
+  } else {
+    ret.assign( diff, diff.size() - size, size );
+  }
+  return std::make_shared<const std::string>( ret );
 }
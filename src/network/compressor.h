@@ -33,29 +33,115 @@
 #ifndef COMPRESSOR_H
 #define COMPRESSOR_H
 
+#include <memory>
+#include <stdint.h>
 #include <string>
 
+#include "src/include/config.h"
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
 namespace Network {
+/* Compression backends.  zlib is always built in; the others only
+   when configure finds them, and are used only with a peer that
+   advertises them too. */
+enum Compression
+{
+  COMPRESSION_NONE = 0,
+  COMPRESSION_ZLIB = 1,
+  COMPRESSION_ZSTD = 2,
+  COMPRESSION_LZ4 = 3
+};
+
+/* Network::FEATURE_* bits of the backends built in */
+uint32_t compression_features( void );
+
+/* "zlib", "zstd" or "lz4"; COMPRESSION_NONE if unknown or not built in */
+Compression compression_from_name( const char* name );
+const char* compression_name( Compression method );
+
+/* the preferred backend if the peer has it, otherwise zlib */
+Compression negotiate_compression( Compression preferred, uint32_t remote_features );
+
+/* Built-in dictionary, priming instructions and short histories when
+   the peer knows it too (Network::FEATURE_DICTIONARY); empty for
+   unknown versions. */
+static const uint32_t DICTIONARY_VERSION = 1;
+const std::string& builtin_dictionary( uint32_t version );
+
+/* Compresses into output grown as needed, so its only memory is the
+   state of the streams it has used.  Each user (or thread) has its own. */
 class Compressor
 {
 private:
-  static const int BUFFER_SIZE = 2048 * 2048; /* effective limit on terminal size */
+  /* kept between calls, and reset for each one */
+  z_stream deflater, inflater;
+  bool deflater_ready, inflater_ready;
+  std::string primed; /* the end of a dictionary followed by a short history */
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx* zstd_compressor; /* created on first use */
+  ZSTD_DCtx* zstd_decompressor;
+#endif
+#ifdef HAVE_LZ4
+  LZ4_stream_t* lz4_stream;
+#endif
 
-  unsigned char buffer[BUFFER_SIZE];
+  const std::string& prime( const std::string& history, uint32_t dictionary );
+
+  /* compressors append to output; decompressors replace it */
+  void zlib_compress( const std::string& input, const std::string& history, std::string& output );
+  void zlib_uncompress( const char* input, size_t size, const std::string& history, bool raw, std::string& output );
+#ifdef HAVE_ZSTD
+  void zstd_compress( const std::string& input, const std::string& history, std::string& output );
+  void zstd_uncompress( const char* input, size_t size, const std::string& history, std::string& output );
+#endif
+#ifdef HAVE_LZ4
+  void lz4_compress( const std::string& input, const std::string& history, std::string& output );
+  void lz4_uncompress( const char* input, size_t size, const std::string& history, std::string& output );
+#endif
 
 public:
-  Compressor() : buffer() {}
-  ~Compressor() {}
+  static const int HISTORY_BITS = 12;
+  static const size_t HISTORY_SIZE = 1 << HISTORY_BITS; /* bytes of history used as a dictionary */
+  static const size_t MAX_UNCOMPRESSED = 64 << 20;      /* far beyond any screen, but bounds a peer */
+
+  Compressor();
+  ~Compressor();
+
+  /* Self-describing: zstd frames, tagged LZ4 blocks and tagged raw
+     deflate primed with a built-in dictionary (zlib only) are told
+     apart from zlib streams by their first bytes. */
+  std::string compress_str( const std::string& input,
+                            Compression method = COMPRESSION_ZLIB,
+                            uint32_t dictionary = 0 );
+  std::string uncompress_str( const std::string& input ) { return uncompress_str( input.data(), input.size() ); }
+  std::string uncompress_str( const char* input, size_t size );
 
-  std::string compress_str( const std::string& input );
-  std::string uncompress_str( const std::string& input );
+  /* raw streams, with a history both sides hold as the dictionary,
+     optionally filled up to HISTORY_SIZE with the end of a built-in one */
+  std::string compress_str( const std::string& input,
+                            const std::string& history,
+                            Compression method,
+                            uint32_t dictionary = 0 );
+  std::string uncompress_str( const std::string& input,
+                              const std::string& history,
+                              Compression method,
+                              uint32_t dictionary = 0 );
 
   /* unused */
   Compressor( const Compressor& );
   Compressor& operator=( const Compressor& );
 };
 
-Compressor& get_compressor( void );
+/* The history after a diff: the end of the one before, followed by the diff. */
+std::shared_ptr<const std::string> next_history( const std::shared_ptr<const std::string>& history,
+                                                 const std::string& diff );
 }
 
 #endif
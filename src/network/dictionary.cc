@@ -0,0 +1,110 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#include "compressor.h"
+
+using namespace Network;
+
+/* Built-in dictionaries, filling up short histories when both sides
+   know them, so that the first diffs of a session compress too; the
+   most useful strings come last.  Gathered from the output of typical
+   sessions, and never changed once released: a better one takes the
+   next version. */
+
+static const char dictionary_1[] =
+  /* modes and renditions, as Display::new_frame() and applications write them */
+  "\033[?25l\033[?25h\033[0m\033[K\033[J\033[H\033[2J"
+  "\033[?1049h\033[?1049l\033[?2004h\033[?2004l"
+  "\033[?1h\033=\033[?1l\033>\033]0;\a"
+  "\033[0;1;34m\033[0;1;32m\033[0;1;31m\033[0;1;33m\033[0;1;36m"
+  "\033[0;7m\033[0;1m\033[0;4m"
+  "\033[0;31m\033[0;32m\033[0;33m\033[0;34m\033[0;35m\033[0;36m\033[0;37m\033[0;90m"
+  "\033[0;38;5;\033[0;48;5;\033[0;38;2;"
+  "\033[01;32m\033[01;34m\033[00m"
+  "\033[1m\033[7m\033[27m\033[m\033[39m\033[49m\033[22m\033[K\r\n"
+  /* cursor motion and editing */
+  "\033[1;1H\033[2;1H\033[3;1H\033[4;1H\033[5;1H\033[6;1H\033[7;1H\033[8;1H"
+  "\033[9;1H\033[10;1H\033[11;1H\033[12;1H\033[13;1H\033[14;1H\033[15;1H\033[16;1H"
+  "\033[17;1H\033[18;1H\033[19;1H\033[20;1H\033[21;1H\033[22;1H\033[23;1H\033[24;1H"
+  "\033[24;80H\033[1;80H"
+  "\033[C\033[D\033[A\033[B"
+  "\033[P\033[@\033[X\033[L\033[M"
+  "\033[r\033[1;24r"
+  /* shells, prompts and common output */
+  "\r\n$ \r\n# \r\n~$ ]$ ]# :~$ :~/src$ "
+  "user@host root@localhost ubuntu@ip-10-0- ec2-user@ [root@ ~]# "
+  "~/.config /home/ /usr/bin/ /usr/lib/ /etc/ /var/log/ /tmp/ "
+  "total drwxr-xr-x  2 root root  4096 -rw-r--r--  1 -rwxr-xr-x lrwxrwxrwx  -> "
+  "Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec  00:00 "
+  "commit Author: Date:   Merge: "
+  "On branch main Your branch is up to date with 'origin/main'. "
+  "Changes not staged for commit: modified:   new file:   deleted:    "
+  "Untracked files: nothing to commit, working tree clean "
+  "git status git diff git log git pull git push git commit -m "
+  "ls -la cd .. sudo apt make -j vim ssh cat grep -r tail -f less top htop python3 docker kubectl exit "
+  "-- INSERT -- "
+  "~                                                                                \" "
+  "load average: Tasks: total,  running, sleeping, "
+  "%Cpu(s):  us,  sy,  id, MiB Mem :  free,  used,  "
+  "PID USER      PR  NI    VIRT    RES    SHR S  %CPU  %MEM     TIME+ COMMAND "
+  "error: warning: No such file or directory Permission denied command not found"
+  /* HostBuffers::ScreenDelta framing: echoed keystrokes, rows of a listing, cursor moves */
+  "\x0a\x1c\x4a\x1a"
+  "\x52\x01\x00"
+  "\x62\x10\x88\x01\x01\x90\x01\x11\x98\x01\x00\xa0\x01\x01\xaa\x01\x01\x20"
+  "\x6a\x03\xc8\x01\x12"
+  "\x0a\x66\x4a\x64"
+  "\x52\x09\x00\xa2\x80\x80\x80\x80\x80\x80\x02"
+  "\x62\x38\x88\x01\x05\x90\x01\x00\x98\x01\x00\xa0\x01\x29\xaa\x01\x29"
+  "\x0a\x2f\x4a\x2d"
+  "\x52\x01\x1f\x5a\x07\x70\x00\x78\x01\x80\x01\x17"
+  "\x62\x1a\x88\x01\x17\x90\x01\x14\x98\x01\x00\xa0\x01\x0b\xaa\x01\x0b"
+  "\x6a\x03\xc0\x01\x10\xc8\x01\x17"
+  "\x6a\x06\xc0\x01\x10\xc8\x01\x17"
+  "\x52\x01\x00"
+  "\x62\x0f\x88\x01\x17\x90\x01\x1a\x98\x01\x00\xa0\x01\x01\xaa\x01\x00"
+  "\x6a\x03\xc8\x01\x1a"
+  "\x52\x02\x21\x00\x5a\x07\x70\x00\x78\x02\x80\x01\x16"
+  "\x62\x26\x88\x01\x16\x90\x01\x00\x98\x01\x00\xa0\x01\x17\xaa\x01\x17";
+
+const std::string& Network::builtin_dictionary( uint32_t version )
+{
+  static const std::string none;
+  static const std::string one( dictionary_1, sizeof( dictionary_1 ) - 1 ); /* it contains NULs */
+
+  switch ( version ) {
+    case 1:
+      return one;
+    default:
+      return none;
+  }
+}
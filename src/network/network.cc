@@ -32,6 +32,7 @@
 
 #include "src/include/config.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstring>
@@ -43,6 +44,7 @@
 #endif
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <unistd.h>
 
 #include "src/crypto/byteorder.h"
@@ -61,6 +63,16 @@
 #define AI_NUMERICSERV 0
 #endif
 
+#ifdef HAVE_RECVMMSG
+typedef struct mmsghdr recv_header;
+#else
+struct recv_header
+{
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
 using namespace Network;
 using namespace Crypto;
 
@@ -69,33 +81,50 @@ const uint64_t SEQUENCE_MASK = uint64_t( -1 ) ^ DIRECTION_MASK;
 
 /* Read in packet */
 Packet::Packet( const Message& message )
-  : seq( message.nonce.val() & SEQUENCE_MASK ),
-    direction( ( message.nonce.val() & DIRECTION_MASK ) ? TO_CLIENT : TO_SERVER ), timestamp( -1 ),
-    timestamp_reply( -1 ), payload()
+  : Packet( message.nonce.val(), message.text.data(), message.text.size() )
+{
+  payload = std::string( message.text.begin() + HEADER_LEN, message.text.end() );
+}
+
+/* Read in the header of a decrypted text */
+Packet::Packet( uint64_t nonce_val, const char* text, size_t len )
+  : seq( nonce_val & SEQUENCE_MASK ), direction( ( nonce_val & DIRECTION_MASK ) ? TO_CLIENT : TO_SERVER ),
+    timestamp( -1 ), timestamp_reply( -1 ), payload()
 {
-  dos_assert( message.text.size() >= 2 * sizeof( uint16_t ) );
+  dos_assert( len >= HEADER_LEN );
 
-  const uint16_t* data = (uint16_t*)message.text.data();
+  uint16_t data[2];
+  memcpy( data, text, HEADER_LEN );
   timestamp = be16toh( data[0] );
   timestamp_reply = be16toh( data[1] );
-
-  payload = std::string( message.text.begin() + 2 * sizeof( uint16_t ), message.text.end() );
 }
 
-/* Output from packet */
-Message Packet::toMessage( void )
+Nonce Packet::nonce( void ) const
 {
   uint64_t direction_seq = ( uint64_t( direction == TO_CLIENT ) << 63 ) | ( seq & SEQUENCE_MASK );
 
+  return Nonce( direction_seq );
+}
+
+void Packet::write_header( char* text ) const
+{
   uint16_t ts_net[2]
     = { static_cast<uint16_t>( htobe16( timestamp ) ), static_cast<uint16_t>( htobe16( timestamp_reply ) ) };
 
-  std::string timestamps = std::string( (char*)ts_net, 2 * sizeof( uint16_t ) );
+  memcpy( text, ts_net, HEADER_LEN );
+}
 
-  return Message( Nonce( direction_seq ), timestamps + payload );
+/* Output from packet */
+Message Packet::toMessage( void )
+{
+  std::string text( HEADER_LEN, '\0' );
+  write_header( &text[0] );
+
+  return Message( nonce(), text + payload );
 }
 
-Packet Connection::new_packet( const std::string& s_payload )
+/* The timestamp reply for the next datagram sent */
+uint16_t Connection::next_timestamp_reply( void )
 {
   uint16_t outgoing_timestamp_reply = -1;
 
@@ -108,9 +137,7 @@ Packet Connection::new_packet( const std::string& s_payload )
     saved_timestamp_received_at = 0;
   }
 
-  Packet p( direction, timestamp16(), outgoing_timestamp_reply, s_payload );
-
-  return p;
+  return outgoing_timestamp_reply;
 }
 
 void Connection::hop_port( void )
@@ -120,10 +147,47 @@ void Connection::hop_port( void )
   setup();
   assert( remote_addr_len != 0 );
   socks.push_back( Socket( remote_addr.sa.sa_family ) );
+  if ( gro ) {
+    enable_gro( sock() );
+  }
 
   prune_sockets();
 }
 
+/* Ask for datagrams from one sender to arrive coalesced; false if the system can't */
+bool Connection::enable_gro( int fd )
+{
+#ifdef HAVE_UDP_GRO
+  const int on = 1;
+  return setsockopt( fd, IPPROTO_UDP, UDP_GRO, &on, sizeof on ) == 0;
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+void Connection::set_udp_offload( bool enable )
+{
+  gso = gro = false;
+  if ( !enable ) {
+    return;
+  }
+
+#ifdef HAVE_UDP_SEGMENT
+  /* probe: kernels without UDP GSO reject the option */
+  const int off = 0;
+  gso = setsockopt( sock(), IPPROTO_UDP, UDP_SEGMENT, &off, sizeof off ) == 0;
+#endif
+
+  for ( std::deque<Socket>::const_iterator it = socks.begin(); it != socks.end(); it++ ) {
+    gro = enable_gro( it->fd() ) || gro;
+  }
+  if ( gro ) { /* room for coalesced datagrams */
+    assert( !recv_pending() );
+    recv_batch = std::make_shared<RecvBatch>( GRO_BATCH, GRO_MAX_BYTES );
+  }
+}
+
 void Connection::prune_sockets( void )
 {
   /* don't keep old sockets if the new socket has been working for long enough */
@@ -207,6 +271,186 @@ void Connection::set_MTU( int family )
   }
 }
 
+/* Room for a batch of datagrams with their source addresses and ECN,
+   filled by one recvmmsg() where the system has it.  With UDP_GRO, the
+   system may coalesce several datagrams from one sender into a slot;
+   they are split into segments again.  Datagrams land where their text
+   is 16-byte aligned, and are decrypted in place, several at a time,
+   before recv() hands them out. */
+class Connection::RecvBatch
+{
+public:
+  static const size_t CONTROL_LEN = 64;
+  static const size_t SLOT_HEADROOM = 16 - Session::HEADROOM;
+
+  struct Segment
+  {
+    unsigned int slot;
+    size_t offset, len;
+    /* once decrypted */
+    bool authentic;
+    Span text;
+    uint64_t nonce_val;
+  };
+
+  const unsigned int slots;
+  const size_t slot_len;
+  const size_t slot_stride;
+  std::vector<recv_header> headers;
+  std::vector<struct iovec> iovecs;
+  std::vector<Addr> addrs;
+  AlignedBuffer payloads;
+  std::vector<char> controls;
+  std::vector<bool> congestion; /* per slot */
+
+  std::vector<Segment> segments;
+  size_t next;
+
+  RecvBatch( unsigned int s_slots, size_t s_slot_len )
+    : slots( s_slots ), slot_len( s_slot_len ), slot_stride( 16 + ( ( slot_len + 15 ) & ~size_t( 15 ) ) ),
+      headers( slots ), iovecs( slots ), addrs( slots ), payloads( slots * slot_stride ),
+      controls( slots * CONTROL_LEN ), congestion( slots ), segments(), next( 0 )
+  {}
+
+  char* payload( const Segment& segment ) const
+  {
+    return payloads.data() + segment.slot * slot_stride + SLOT_HEADROOM + segment.offset;
+  }
+
+  /* read what is waiting on sock, up to a slot per datagram */
+  void read( int sock )
+  {
+    for ( unsigned int i = 0; i < slots; i++ ) {
+      struct msghdr& header = headers[i].msg_hdr;
+
+      /* receive source address */
+      header.msg_name = &addrs[i];
+      header.msg_namelen = sizeof addrs[i];
+
+      /* receive payload */
+      iovecs[i].iov_base = payloads.data() + i * slot_stride + SLOT_HEADROOM;
+      iovecs[i].iov_len = slot_len;
+      header.msg_iov = &iovecs[i];
+      header.msg_iovlen = 1;
+
+      /* receive explicit congestion notification */
+      header.msg_control = &controls[i * CONTROL_LEN];
+      header.msg_controllen = CONTROL_LEN;
+
+      /* receive flags */
+      header.msg_flags = 0;
+    }
+
+#ifdef HAVE_RECVMMSG
+    int received = recvmmsg( sock, &headers[0], slots, MSG_DONTWAIT, NULL );
+    if ( received < 0 ) {
+      throw NetworkException( "recvmmsg", errno );
+    }
+#else
+    ssize_t received_len = recvmsg( sock, &headers[0].msg_hdr, MSG_DONTWAIT );
+    if ( received_len < 0 ) {
+      throw NetworkException( "recvmsg", errno );
+    }
+    headers[0].msg_len = received_len;
+    int received = 1;
+#endif
+
+    segments.clear();
+    next = 0;
+    for ( int i = 0; i < received; i++ ) {
+      const size_t len = headers[i].msg_len;
+      size_t segment_len = len;
+      congestion[i] = false;
+
+      for ( struct cmsghdr* cmsg = CMSG_FIRSTHDR( &headers[i].msg_hdr ); cmsg != NULL;
+            cmsg = CMSG_NXTHDR( &headers[i].msg_hdr, cmsg ) ) {
+        if ( cmsg->cmsg_level == IPPROTO_IP
+             && ( cmsg->cmsg_type == IP_TOS
+#ifdef IP_RECVTOS
+                  || cmsg->cmsg_type == IP_RECVTOS
+#endif
+                  ) ) {
+          /* got one */
+          const uint8_t* ecn_octet_p = (const uint8_t*)CMSG_DATA( cmsg );
+          assert( ecn_octet_p );
+
+          congestion[i] = ( *ecn_octet_p & 0x03 ) == 0x03;
+        }
+#ifdef HAVE_UDP_GRO
+        if ( cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO ) {
+          int gso_size;
+          memcpy( &gso_size, CMSG_DATA( cmsg ), sizeof gso_size );
+          if ( gso_size > 0 ) {
+            segment_len = gso_size;
+          }
+        }
+#endif
+      }
+
+      /* a truncated datagram is one segment, for recv_one() to reject */
+      if ( headers[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+        segment_len = len;
+      }
+      size_t offset = 0;
+      do {
+        const Segment segment
+          = { static_cast<unsigned int>( i ), offset, std::min( segment_len, len - offset ), false, Span(), 0 };
+        segments.push_back( segment );
+        offset += segment.len;
+      } while ( offset < len );
+    }
+  }
+};
+
+/* Datagrams to send together, each written and encrypted in place in a
+   slot that is kept for the next batch: the sent part of the nonce, then
+   the text to encrypt (timestamps and payload) from a 16-byte boundary,
+   then room for the tag. */
+class Connection::SendBatch
+{
+public:
+  static const size_t TEXT_OFFSET = 16;
+  static const size_t SLOT_LEN = TEXT_OFFSET + Session::RECEIVE_MTU;
+  static const size_t PAYLOAD_ROOM = Session::RECEIVE_MTU - Packet::HEADER_LEN - Session::ADDED_BYTES;
+
+  std::vector<std::unique_ptr<AlignedBuffer>> slots;
+  std::vector<size_t> lens; /* of each payload, then of each datagram once encrypted */
+  std::vector<struct iovec> iovecs;
+#ifdef HAVE_SENDMMSG
+  std::vector<struct mmsghdr> headers;
+#endif
+  size_t count;
+
+  SendBatch()
+    : slots(), lens(), iovecs(),
+#ifdef HAVE_SENDMMSG
+      headers(),
+#endif
+      count( 0 )
+  {}
+
+  char* text( size_t i ) const { return slots[i]->data() + TEXT_OFFSET; }
+  char* datagram( size_t i ) const { return text( i ) - Session::HEADROOM; }
+  /* len bytes of text in slot i, with the room around them */
+  Span text_span( size_t i, size_t len ) const
+  {
+    return Span( text( i ), len, TEXT_OFFSET, SLOT_LEN - TEXT_OFFSET - len );
+  }
+
+  char* new_payload( void )
+  {
+    if ( count == slots.size() ) {
+      slots.push_back( std::unique_ptr<AlignedBuffer>( new AlignedBuffer( SLOT_LEN ) ) );
+      lens.push_back( 0 );
+      iovecs.push_back( iovec() );
+#ifdef HAVE_SENDMMSG
+      headers.push_back( mmsghdr() );
+#endif
+    }
+    return text( count ) + Packet::HEADER_LEN;
+  }
+};
+
 class AddrInfo
 {
 public:
@@ -227,11 +471,15 @@ private:
   AddrInfo& operator=( const AddrInfo& );
 };
 
-Connection::Connection( const char* desired_ip, const char* desired_port ) /* server */
+Connection::Connection( const char* desired_ip,
+                        const char* desired_port,
+                        Crypto::Algorithm algorithm ) /* server */
   : socks(), has_remote_addr( false ), remote_addr(), remote_addr_len( 0 ), server( true ), MTU( DEFAULT_SEND_MTU ),
-    key(), session( key ), direction( TO_CLIENT ), saved_timestamp( -1 ), saved_timestamp_received_at( 0 ),
-    expected_receiver_seq( 0 ), last_heard( -1 ), last_port_choice( -1 ), last_roundtrip_success( -1 ),
-    RTT_hit( false ), SRTT( 1000 ), RTTVAR( 500 ), send_error()
+    key( algorithm ), session( key ), direction( TO_CLIENT ), saved_timestamp( -1 ),
+    saved_timestamp_received_at( 0 ), expected_receiver_seq( 0 ), last_heard( -1 ), last_port_choice( -1 ),
+    last_roundtrip_success( -1 ), RTT_hit( false ), SRTT( 1000 ), RTTVAR( 500 ), send_error(),
+    send_batch( std::make_shared<SendBatch>() ),
+    recv_batch( std::make_shared<RecvBatch>( RECV_BATCH, Session::RECEIVE_MTU ) ), gso( false ), gro( false )
 {
   setup();
 
@@ -342,7 +590,9 @@ Connection::Connection( const char* key_str, const char* ip, const char* port )
   : socks(), has_remote_addr( false ), remote_addr(), remote_addr_len( 0 ), server( false ),
     MTU( DEFAULT_SEND_MTU ), key( key_str ), session( key ), direction( TO_SERVER ), saved_timestamp( -1 ),
     saved_timestamp_received_at( 0 ), expected_receiver_seq( 0 ), last_heard( -1 ), last_port_choice( -1 ),
-    last_roundtrip_success( -1 ), RTT_hit( false ), SRTT( 1000 ), RTTVAR( 500 ), send_error()
+    last_roundtrip_success( -1 ), RTT_hit( false ), SRTT( 1000 ), RTTVAR( 500 ), send_error(),
+    send_batch( std::make_shared<SendBatch>() ),
+    recv_batch( std::make_shared<RecvBatch>( RECV_BATCH, Session::RECEIVE_MTU ) ), gso( false ), gro( false )
 {
   setup();
 
@@ -364,28 +614,168 @@ Connection::Connection( const char* key_str, const char* ip, const char* port )
   set_MTU( remote_addr.sa.sa_family );
 }
 
-void Connection::send( const std::string& s )
+void Connection::note_send_error( const char* function )
+{
+  /* Make sendto() failure available to the frontend. */
+  send_error = function;
+  send_error += ": ";
+  send_error += strerror( errno );
+
+  if ( errno == EMSGSIZE ) {
+    MTU = DEFAULT_SEND_MTU; /* payload MTU of last resort */
+  }
+}
+
+/* Sends the batch from datagram first on, one datagram at a time */
+void Connection::send_each( size_t first )
+{
+  SendBatch& batch = *send_batch;
+#ifdef HAVE_SENDMMSG
+  /* one system call for all of them, unless one fails; then note it and carry on after it */
+  for ( size_t i = first; i < batch.count; i++ ) {
+    batch.iovecs[i].iov_base = batch.datagram( i );
+    batch.iovecs[i].iov_len = batch.lens[i];
+    batch.headers[i].msg_hdr.msg_name = &remote_addr;
+    batch.headers[i].msg_hdr.msg_namelen = remote_addr_len;
+    batch.headers[i].msg_hdr.msg_iov = &batch.iovecs[i];
+    batch.headers[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t sent = first;
+  while ( sent < batch.count ) {
+    int count = sendmmsg( sock(), &batch.headers[sent], batch.count - sent, MSG_DONTWAIT );
+    if ( count <= 0 ) {
+      note_send_error( "sendmmsg" );
+      sent++;
+    } else {
+      sent += count;
+    }
+  }
+#else
+  for ( size_t i = first; i < batch.count; i++ ) {
+    ssize_t bytes_sent
+      = sendto( sock(), batch.datagram( i ), batch.lens[i], MSG_DONTWAIT, &remote_addr.sa, remote_addr_len );
+
+    if ( bytes_sent != static_cast<ssize_t>( batch.lens[i] ) ) {
+      note_send_error( "sendto" );
+    }
+  }
+#endif
+}
+
+/* Sends runs of equal-sized datagrams (the last may be shorter) as one
+   buffer for the system to segment, returning how many were handled.
+   If the system cannot segment them, turns segmentation off and leaves
+   the rest to send_each(). */
+size_t Connection::send_segmented( void )
+{
+  size_t sent = 0;
+#ifdef HAVE_UDP_SEGMENT
+  SendBatch& batch = *send_batch;
+  while ( batch.count - sent > 1 ) {
+    const size_t segment_size = batch.lens[sent];
+    size_t buffer_len = segment_size;
+    size_t count = 1;
+    while ( sent + count < batch.count && count < GSO_MAX_SEGMENTS && buffer_len + segment_size <= GSO_MAX_BYTES ) {
+      const size_t next_len = batch.lens[sent + count];
+      if ( next_len > segment_size ) {
+        break;
+      }
+      buffer_len += next_len;
+      count++;
+      if ( next_len < segment_size ) {
+        break;
+      }
+    }
+    if ( count == 1 ) {
+      break;
+    }
+
+    /* the datagrams stay where they are, gathered by the system */
+    for ( size_t i = sent; i < sent + count; i++ ) {
+      batch.iovecs[i].iov_base = batch.datagram( i );
+      batch.iovecs[i].iov_len = batch.lens[i];
+    }
+
+    char msg_control[CMSG_SPACE( sizeof( uint16_t ) )];
+    memset( msg_control, 0, sizeof msg_control );
+
+    struct msghdr header;
+    memset( &header, 0, sizeof header );
+    header.msg_name = &remote_addr;
+    header.msg_namelen = remote_addr_len;
+    header.msg_iov = &batch.iovecs[sent];
+    header.msg_iovlen = count;
+    header.msg_control = msg_control;
+    header.msg_controllen = sizeof msg_control;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR( &header );
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+    const uint16_t gso_size = segment_size;
+    memcpy( CMSG_DATA( cmsg ), &gso_size, sizeof gso_size );
+
+    ssize_t bytes_sent = sendmsg( sock(), &header, MSG_DONTWAIT );
+    if ( bytes_sent != static_cast<ssize_t>( buffer_len ) ) {
+      if ( ( errno == EIO ) || ( errno == EINVAL ) || ( errno == EOPNOTSUPP ) || ( errno == ENOPROTOOPT ) ) {
+        /* e.g. EIO from a device without checksum offload: send these, and the rest, without */
+        gso = false;
+        break;
+      }
+      /* unreachable while roaming, say, which says nothing about segmentation */
+      note_send_error( "sendmsg" );
+    }
+    sent += count;
+  }
+#endif
+  return sent;
+}
+
+char* Connection::new_payload( void )
+{
+  return send_batch->new_payload();
+}
+
+void Connection::add_payload( size_t len )
 {
+  fatal_assert( len <= SendBatch::PAYLOAD_ROOM );
+  send_batch->lens[send_batch->count++] = len;
+}
+
+void Connection::send( void )
+{
+  SendBatch& batch = *send_batch;
   if ( !has_remote_addr ) {
+    batch.count = 0;
     return;
   }
 
-  Packet px = new_packet( s );
+  /* stamp each payload where it was written, and encrypt them together */
+  for ( size_t first = 0; first < batch.count; first += Session::BATCH_MAX ) {
+    const size_t n = std::min( batch.count - first, size_t( Session::BATCH_MAX ) );
+    Nonce nonces[Session::BATCH_MAX];
+    Span texts[Session::BATCH_MAX];
 
-  std::string p = session.encrypt( px.toMessage() );
+    for ( size_t i = 0; i < n; i++ ) {
+      const uint16_t outgoing_timestamp_reply = next_timestamp_reply();
+      const Packet p( direction, timestamp16(), outgoing_timestamp_reply );
 
-  ssize_t bytes_sent = sendto( sock(), p.data(), p.size(), MSG_DONTWAIT, &remote_addr.sa, remote_addr_len );
-
-  if ( bytes_sent != static_cast<ssize_t>( p.size() ) ) {
-    /* Make sendto() failure available to the frontend. */
-    send_error = "sendto: ";
-    send_error += strerror( errno );
+      texts[i] = batch.text_span( first + i, Packet::HEADER_LEN + batch.lens[first + i] );
+      p.write_header( texts[i].data );
+      nonces[i] = p.nonce();
+    }
 
-    if ( errno == EMSGSIZE ) {
-      MTU = DEFAULT_SEND_MTU; /* payload MTU of last resort */
+    session.encrypt_batch( n, nonces, texts );
+    for ( size_t i = 0; i < n; i++ ) {
+      batch.lens[first + i] = texts[i].len;
     }
   }
 
+  const size_t segmented = gso ? send_segmented() : 0;
+  send_each( segmented );
+  batch.count = 0;
+
   uint64_t now = timestamp();
   if ( server ) {
     if ( now - last_heard > SERVER_ASSOCIATION_TIMEOUT ) {
@@ -399,13 +789,26 @@ void Connection::send( const std::string& s )
   }
 }
 
-std::string Connection::recv( void )
+const char* Connection::recv( size_t& len )
+{
+  if ( !recv_pending() ) {
+    recv_batch_fill();
+  }
+  return recv_one( len );
+}
+
+bool Connection::recv_pending( void ) const
+{
+  return recv_batch->next < recv_batch->segments.size();
+}
+
+/* Read what is waiting on the first socket that has anything */
+void Connection::recv_batch_fill( void )
 {
   assert( !socks.empty() );
   for ( std::deque<Socket>::const_iterator it = socks.begin(); it != socks.end(); it++ ) {
-    std::string payload;
     try {
-      payload = recv_one( it->fd() );
+      recv_batch->read( it->fd() );
     } catch ( NetworkException& e ) {
       if ( ( e.the_errno == EAGAIN ) || ( e.the_errno == EWOULDBLOCK ) ) {
         continue;
@@ -416,72 +819,88 @@ std::string Connection::recv( void )
 
     /* succeeded */
     prune_sockets();
-    return payload;
+    recv_batch_decrypt();
+    return;
   }
   throw NetworkException( "No packet received" );
 }
 
-std::string Connection::recv_one( int sock_to_recv )
+/* Decrypt the datagrams just read where they are, several at a time */
+void Connection::recv_batch_decrypt( void )
 {
-  /* receive source address, ECN, and payload in msghdr structure */
-  Addr packet_remote_addr;
-  struct msghdr header;
-  struct iovec msg_iovec;
-
-  char msg_payload[Session::RECEIVE_MTU];
-  char msg_control[Session::RECEIVE_MTU];
-
-  /* receive source address */
-  header.msg_name = &packet_remote_addr;
-  header.msg_namelen = sizeof packet_remote_addr;
-
-  /* receive payload */
-  msg_iovec.iov_base = msg_payload;
-  msg_iovec.iov_len = sizeof msg_payload;
-  header.msg_iov = &msg_iovec;
-  header.msg_iovlen = 1;
-
-  /* receive explicit congestion notification */
-  header.msg_control = msg_control;
-  header.msg_controllen = sizeof msg_control;
+  RecvBatch& batch = *recv_batch;
+  size_t s = 0;
+
+  while ( s < batch.segments.size() ) {
+    Span datagrams[Session::BATCH_MAX];
+    uint64_t nonce_vals[Session::BATCH_MAX] = {};
+    bool ok[Session::BATCH_MAX];
+    size_t which[Session::BATCH_MAX]; /* segment of each datagram */
+    size_t n = 0;
+
+    for ( ; ( s < batch.segments.size() ) && ( n < Session::BATCH_MAX ); s++ ) {
+      const RecvBatch::Segment& segment = batch.segments[s];
+      if ( batch.headers[segment.slot].msg_hdr.msg_flags & MSG_TRUNC ) {
+        continue; /* for recv_one() to reject */
+      }
 
-  /* receive flags */
-  header.msg_flags = 0;
+      /* A coalesced datagram after the first may lie off the alignment for
+         decrypting in place; it is moved back over the tag of the one
+         before, so that one is decrypted first. */
+      char* datagram = batch.payload( segment );
+      const size_t misalignment = (uintptr_t)( datagram + Session::HEADROOM ) & 0xF;
+      if ( misalignment ) {
+        if ( n > 0 ) {
+          break;
+        }
+        assert( segment.offset >= misalignment );
+        memmove( datagram - misalignment, datagram, segment.len );
+        datagram -= misalignment;
+      }
 
-  ssize_t received_len = recvmsg( sock_to_recv, &header, MSG_DONTWAIT );
+      datagrams[n] = Span( datagram, segment.len );
+      which[n++] = s;
+    }
 
-  if ( received_len < 0 ) {
-    throw NetworkException( "recvmsg", errno );
+    session.decrypt_batch( n, datagrams, nonce_vals, ok );
+    for ( size_t i = 0; i < n; i++ ) {
+      RecvBatch::Segment& segment = batch.segments[which[i]];
+      segment.authentic = ok[i];
+      segment.text = datagrams[i];
+      segment.nonce_val = nonce_vals[i];
+    }
   }
+}
+
+/* Account for the next datagram of the batch, decrypted where it is */
+const char* Connection::recv_one( size_t& len )
+{
+  assert( recv_pending() );
+  const RecvBatch::Segment& segment = recv_batch->segments[recv_batch->next++];
+  const struct msghdr& header = recv_batch->headers[segment.slot].msg_hdr;
+  const Addr& packet_remote_addr = recv_batch->addrs[segment.slot];
 
   if ( header.msg_flags & MSG_TRUNC ) {
     throw NetworkException( "Received oversize datagram", errno );
   }
 
-  /* receive ECN */
-  bool congestion_experienced = false;
-
-  struct cmsghdr* ecn_hdr = CMSG_FIRSTHDR( &header );
-  if ( ecn_hdr && ecn_hdr->cmsg_level == IPPROTO_IP
-       && ( ecn_hdr->cmsg_type == IP_TOS
-#ifdef IP_RECVTOS
-            || ecn_hdr->cmsg_type == IP_RECVTOS
-#endif
-            ) ) {
-    /* got one */
-    uint8_t* ecn_octet_p = (uint8_t*)CMSG_DATA( ecn_hdr );
-    assert( ecn_octet_p );
-
-    congestion_experienced = ( *ecn_octet_p & 0x03 ) == 0x03;
+  if ( !segment.authentic ) {
+    throw CryptoException( "Packet failed integrity check." );
   }
 
-  Packet p( session.decrypt( msg_payload, received_len ) );
+  /* ECN, from the control data of the datagram (or coalesced datagrams) */
+  const bool congestion_experienced = recv_batch->congestion[segment.slot];
+
+  const Span& text = segment.text;
+  const Packet p( segment.nonce_val, text.data, text.len );
+  const char* payload = text.data + Packet::HEADER_LEN;
+  len = text.len - Packet::HEADER_LEN;
 
   dos_assert( p.direction == ( server ? TO_SERVER : TO_CLIENT ) ); /* prevent malicious playback to sender */
 
   if ( p.seq
        < expected_receiver_seq ) { /* don't use (but do return) out-of-order packets for timestamp or targeting */
-    return p.payload;
+    return payload;
   }
   expected_receiver_seq = p.seq + 1; /* this is security-sensitive because a replay attack could otherwise
                                         screw up the timestamp and targeting */
@@ -541,7 +960,7 @@ std::string Connection::recv_one( int sock_to_recv )
     }
     fprintf( stderr, "Server now attached to client at %s:%s\n", host, serv );
   }
-  return p.payload;
+  return payload;
 }
 
 std::string Connection::port( void ) const
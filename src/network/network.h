@@ -39,6 +39,7 @@
 #include <cstring>
 #include <deque>
 #include <exception>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -52,6 +53,15 @@ using namespace Crypto;
 namespace Network {
 static const unsigned int MOSH_PROTOCOL_VERSION = 2; /* bumped for echo-ack */
 
+/* Optional features, advertised in every instruction.  A side only
+   uses a feature that its peer has advertised; older peers advertise none. */
+static const uint32_t FEATURE_SCREEN_DELTA = 1 << 0; /* understands HostBuffers::ScreenDelta */
+static const uint32_t FEATURE_DIGEST = 1 << 1;       /* verifies HostBuffers::Digest, may ask to resync */
+static const uint32_t FEATURE_HISTORY = 1 << 2;      /* inflates diffs against the history of their state */
+static const uint32_t FEATURE_ZSTD = 1 << 3;         /* decompresses zstd (see Network::Compression) */
+static const uint32_t FEATURE_LZ4 = 1 << 4;          /* decompresses LZ4 */
+static const uint32_t FEATURE_DICTIONARY = 1 << 5;   /* knows built-in dictionary 1 (see builtin_dictionary()) */
+
 uint64_t timestamp( void );
 uint16_t timestamp16( void );
 uint16_t timestamp_diff( uint16_t tsnew, uint16_t tsold );
@@ -82,6 +92,9 @@ enum Direction
 class Packet
 {
 public:
+  /* the timestamps, ahead of the payload in the encrypted text */
+  static const size_t HEADER_LEN = 2 * sizeof( uint16_t );
+
   const uint64_t seq;
   Direction direction;
   uint16_t timestamp, timestamp_reply;
@@ -94,6 +107,16 @@ public:
 
   Packet( const Message& message );
 
+  /* Header only, for a payload written or read in place */
+  Packet( Direction s_direction, uint16_t s_timestamp, uint16_t s_timestamp_reply )
+    : seq( Crypto::unique() ), direction( s_direction ), timestamp( s_timestamp ),
+      timestamp_reply( s_timestamp_reply ), payload()
+  {}
+  Packet( uint64_t nonce_val, const char* text, size_t len );
+
+  Nonce nonce( void ) const;
+  void write_header( char* text ) const;
+
   Message toMessage( void );
 };
 
@@ -196,7 +219,7 @@ private:
   /* Error from send()/sendto(). */
   std::string send_error;
 
-  Packet new_packet( const std::string& s_payload );
+  uint16_t next_timestamp_reply( void );
 
   void hop_port( void );
 
@@ -208,7 +231,31 @@ private:
 
   void prune_sockets( void );
 
-  std::string recv_one( int sock_to_recv );
+  /* datagrams written and encrypted in place, then sent together by send() */
+  class SendBatch;
+  std::shared_ptr<SendBatch> send_batch;
+
+  /* datagrams read together from one socket, handed out by recv() one at a time */
+  static const unsigned int RECV_BATCH = 16;
+  class RecvBatch;
+  std::shared_ptr<RecvBatch> recv_batch;
+
+  /* UDP segmentation offload (GSO) on send and coalescing (GRO) on
+     receive, on Linux when asked for and the kernel has them */
+  static const size_t GSO_MAX_SEGMENTS = 64;
+  static const size_t GSO_MAX_BYTES = 65000;
+  static const unsigned int GRO_BATCH = 4;
+  static const size_t GRO_MAX_BYTES = 65536;
+  bool gso;
+  bool gro;
+
+  void recv_batch_fill( void );
+  void recv_batch_decrypt( void );
+  const char* recv_one( size_t& len );
+  void note_send_error( const char* function );
+  void send_each( size_t first );
+  size_t send_segmented( void );
+  static bool enable_gro( int fd );
 
   void set_MTU( int family );
 
@@ -216,11 +263,27 @@ public:
   /* Network transport overhead. */
   static const int ADDED_BYTES = 8 /* seqno/nonce */ + 4 /* timestamps */;
 
-  Connection( const char* desired_ip, const char* desired_port );      /* server */
+  Connection( const char* desired_ip,
+              const char* desired_port,
+              Crypto::Algorithm algorithm = Crypto::AES_128_OCB ); /* server */
   Connection( const char* key_str, const char* ip, const char* port ); /* client */
 
-  void send( const std::string& s );
-  std::string recv( void );
+  /* Payloads are written in place: new_payload() gives room for one of up to
+     get_MTU() - ADDED_BYTES - Session::ADDED_BYTES bytes, add_payload() takes
+     what was written there, and send() sends each as its own datagram,
+     together where the system allows. */
+  char* new_payload( void );
+  void add_payload( size_t len );
+  void send( void );
+  /* Returns one payload, reading a batch of datagrams if none is left from
+     the last. It is decrypted in place and stays there until the next recv(). */
+  const char* recv( size_t& len );
+  bool recv_pending( void ) const;
+
+  /* Opt in to UDP GSO and GRO, where the kernel turns out to have them. */
+  void set_udp_offload( bool enable );
+  bool get_gso( void ) const { return gso; }
+  bool get_gro( void ) const { return gro; }
   const std::vector<int> fds( void ) const;
   int get_MTU( void ) const { return MTU; }
 
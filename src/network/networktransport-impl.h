@@ -33,6 +33,9 @@
 #ifndef NETWORK_TRANSPORT_IMPL_HPP
 #define NETWORK_TRANSPORT_IMPL_HPP
 
+#include <exception>
+
+#include "src/network/compressor.h"
 #include "src/network/networktransport.h"
 
 #include "transportsender-impl.h"
@@ -43,10 +46,11 @@ template<class MyState, class RemoteState>
 Transport<MyState, RemoteState>::Transport( MyState& initial_state,
                                             RemoteState& initial_remote,
                                             const char* desired_ip,
-                                            const char* desired_port )
-  : connection( desired_ip, desired_port ), sender( &connection, initial_state ),
-    received_states( 1, TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ),
-    receiver_quench_timer( 0 ), last_receiver_state( initial_remote ), fragments(), verbose( 0 )
+                                            const char* desired_port,
+                                            Crypto::Algorithm algorithm )
+  : connection( desired_ip, desired_port, algorithm ), sender( &connection, initial_state ),
+    received_states( TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ), rationalize_pending( true ),
+    last_receiver_state( initial_remote ), fragments(), verbose( 0 ), remote_features( 0 )
 {
   /* server */
 }
@@ -58,51 +62,66 @@ Transport<MyState, RemoteState>::Transport( MyState& initial_state,
                                             const char* ip,
                                             const char* port )
   : connection( key_str, ip, port ), sender( &connection, initial_state ),
-    received_states( 1, TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ),
-    receiver_quench_timer( 0 ), last_receiver_state( initial_remote ), fragments(), verbose( 0 )
+    received_states( TimestampedState<RemoteState>( timestamp(), 0, initial_remote ) ), rationalize_pending( true ),
+    last_receiver_state( initial_remote ), fragments(), verbose( 0 ), remote_features( 0 )
 {
   /* client */
 }
 
+/* Handle every datagram read together, then report the first failure, if any */
 template<class MyState, class RemoteState>
 void Transport<MyState, RemoteState>::recv( void )
 {
-  std::string s( connection.recv() );
-  Fragment frag( s );
+  std::exception_ptr error;
+  do {
+    try {
+      size_t len;
+      const char* payload = connection.recv( len );
+      recv_fragment( payload, len );
+    } catch ( ... ) {
+      if ( !error ) {
+        error = std::current_exception();
+      }
+    }
+  } while ( connection.recv_pending() );
+
+  if ( error ) {
+    std::rethrow_exception( error );
+  }
+}
+
+template<class MyState, class RemoteState>
+void Transport<MyState, RemoteState>::recv_fragment( const char* payload, size_t len )
+{
+  Instruction inst;
 
-  if ( fragments.add_fragment( frag ) ) { /* complete packet */
-    Instruction inst = fragments.get_assembly();
+  if ( fragments.add_fragment( Fragment( payload, len ), inst ) ) { /* complete packet */
 
     if ( inst.protocol_version() != MOSH_PROTOCOL_VERSION ) {
       throw NetworkException( "mosh protocol version mismatch", 0 );
     }
 
+    remote_features = inst.features();
+    sender.set_remote_features( remote_features );
+
+    if ( inst.has_resync_num() ) {
+      sender.process_resync_request( inst.resync_num() );
+    }
+
     sender.process_acknowledgment_through( inst.ack_num() );
 
     /* inform network layer of roundtrip (end-to-end-to-end) connectivity */
     connection.set_last_roundtrip_success( sender.get_sent_state_acked_timestamp() );
 
     /* first, make sure we don't already have the new state */
-    for ( typename std::list<TimestampedState<RemoteState>>::iterator i = received_states.begin();
-          i != received_states.end();
-          i++ ) {
-      if ( inst.new_num() == i->num ) {
-        return;
-      }
+    if ( received_states.find( inst.new_num() ) ) {
+      return;
     }
 
     /* now, make sure we do have the old state */
-    bool found = 0;
-    typename std::list<TimestampedState<RemoteState>>::iterator reference_state = received_states.begin();
-    while ( reference_state != received_states.end() ) {
-      if ( inst.old_num() == reference_state->num ) {
-        found = true;
-        break;
-      }
-      reference_state++;
-    }
+    const typename StateMap<RemoteState>::pointer reference_state = received_states.find( inst.old_num() );
 
-    if ( !found ) {
+    if ( !reference_state ) {
       //    fprintf( stderr, "Ignoring out-of-order packet. Reference state %d has been discarded or hasn't yet been
       //    received.\n", int(inst.old_num) );
       return; /* this is security-sensitive and part of how we enforce idempotency */
@@ -115,46 +134,63 @@ void Transport<MyState, RemoteState>::recv( void )
 
     process_throwaway_until( inst.throwaway_num() );
 
-    if ( received_states.size() > 1024 ) { /* limit on state queue */
-      uint64_t now = timestamp();
-      if ( now < receiver_quench_timer ) { /* deny letting state grow further */
-        if ( verbose ) {
-          fprintf(
-            stderr,
-            "[%u] Receiver queue full, discarding %d (malicious sender or long-unidirectional connectivity?)\n",
-            (unsigned int)( timestamp() % 100000 ),
-            (int)inst.new_num() );
-        }
-        return;
-      } else {
-        receiver_quench_timer = now + 15000;
+    /* limit on state queue, which lets in one new state at a time however large
+       the screen, since our ack of it is what lets the sender throw away the rest */
+    if ( received_states.size() > 1 && received_states.memory() > RECEIVER_BUDGET ) {
+      if ( verbose ) {
+        fprintf(
+          stderr,
+          "[%u] Receiver queue full, discarding %d (malicious sender or long-unidirectional connectivity?)\n",
+          (unsigned int)( timestamp() % 100000 ),
+          (int)inst.new_num() );
       }
+      return;
     }
 
     /* apply diff to reference state */
-    TimestampedState<RemoteState> new_state = *reference_state;
+    const typename StateMap<RemoteState>::pointer new_state_ptr
+      = std::make_shared<TimestampedState<RemoteState>>( *reference_state );
+    TimestampedState<RemoteState>& new_state = *new_state_ptr;
     new_state.timestamp = timestamp();
     new_state.num = inst.new_num();
 
-    if ( !inst.diff().empty() ) {
-      new_state.state.apply_string( inst.diff() );
+    const std::shared_ptr<const std::string> history
+      = inst.history_reset() ? std::make_shared<const std::string>() : reference_state->history;
+    const Compression method = Compression( inst.diff_compression() & 0xf );
+    const uint32_t dictionary = inst.diff_compression() >> 4;
+    Compressor& compressor = fragments.get_compressor();
+    const std::string diff = inst.diff_compression()
+                               ? compressor.uncompress_str( inst.diff(), *history, method, dictionary )
+                               : inst.diff();
+    new_state.history = next_history( history, diff );
+
+    if ( !diff.empty() && !new_state.state.apply_string( diff ) ) {
+      /* neither keep nor acknowledge it, and ask for a full diff instead */
+      if ( verbose ) {
+        fprintf( stderr,
+                 "[%u] Could not verify state %d, requesting resync\n",
+                 (unsigned int)( timestamp() % 100000 ),
+                 (int)inst.new_num() );
+      }
+      sender.set_resync_num( inst.new_num() );
+      return;
     }
 
     /* Insert new state in sorted place */
-    for ( typename std::list<TimestampedState<RemoteState>>::iterator i = received_states.begin();
-          i != received_states.end();
-          i++ ) {
-      if ( i->num > new_state.num ) {
-        received_states.insert( i, new_state );
-        if ( verbose ) {
-          fprintf( stderr,
-                   "[%u] Received OUT-OF-ORDER state %d [ack %d]\n",
-                   (unsigned int)( timestamp() % 100000 ),
-                   (int)new_state.num,
-                   (int)inst.ack_num() );
-        }
-        return;
+    const size_t position = received_states.insert( new_state_ptr );
+    const bool in_order = ( position == received_states.size() - 1 );
+    if ( position == 0 ) {
+      rationalize_pending = true;
+    }
+    if ( !in_order ) {
+      if ( verbose ) {
+        fprintf( stderr,
+                 "[%u] Received OUT-OF-ORDER state %d [ack %d]\n",
+                 (unsigned int)( timestamp() % 100000 ),
+                 (int)new_state.num,
+                 (int)inst.ack_num() );
       }
+      return;
     }
     if ( verbose ) {
       fprintf( stderr,
@@ -164,11 +200,10 @@ void Transport<MyState, RemoteState>::recv( void )
                (int)inst.old_num(),
                (int)inst.ack_num() );
     }
-    received_states.push_back( new_state );
     sender.set_ack_num( received_states.back().num );
 
     sender.remote_heard( new_state.timestamp );
-    if ( !inst.diff().empty() ) {
+    if ( !diff.empty() ) {
       sender.set_data_ack();
     }
   }
@@ -178,14 +213,8 @@ void Transport<MyState, RemoteState>::recv( void )
 template<class MyState, class RemoteState>
 void Transport<MyState, RemoteState>::process_throwaway_until( uint64_t throwaway_num )
 {
-  typename std::list<TimestampedState<RemoteState>>::iterator i = received_states.begin();
-  while ( i != received_states.end() ) {
-    typename std::list<TimestampedState<RemoteState>>::iterator inext = i;
-    inext++;
-    if ( i->num < throwaway_num ) {
-      received_states.erase( i );
-    }
-    i = inext;
+  if ( received_states.erase_before( throwaway_num ) ) {
+    rationalize_pending = true;
   }
 
   fatal_assert( received_states.size() > 0 );
@@ -198,12 +227,16 @@ std::string Transport<MyState, RemoteState>::get_remote_diff( void )
 
   std::string ret( received_states.back().state.diff_from( last_receiver_state ) );
 
-  const RemoteState* oldest_receiver_state = &received_states.front().state;
+  /* Once the oldest state has been subtracted from itself, it is empty and
+     every later state starts after it; only a new oldest one needs the work. */
+  if ( rationalize_pending ) {
+    rationalize_pending = false;
 
-  for ( typename std::list<TimestampedState<RemoteState>>::reverse_iterator i = received_states.rbegin();
-        i != received_states.rend();
-        i++ ) {
-    i->state.subtract( oldest_receiver_state );
+    const RemoteState* oldest_receiver_state = &received_states.front().state;
+
+    for ( size_t i = received_states.size(); i-- > 0; ) {
+      received_states[i].state.subtract( oldest_receiver_state );
+    }
   }
 
   last_receiver_state = received_states.back().state;
@@ -44,6 +44,9 @@
 #include "transportfragment.h"
 
 namespace Network {
+/* approximate memory for received states the sender has not let us throw away */
+const size_t RECEIVER_BUDGET = 16 << 20;
+
 template<class MyState, class RemoteState>
 class Transport
 {
@@ -55,20 +58,23 @@ private:
   TransportSender<MyState> sender;
 
   /* helper methods for recv() */
+  void recv_fragment( const char* payload, size_t len );
   void process_throwaway_until( uint64_t throwaway_num );
 
   /* simple receiver */
-  std::list<TimestampedState<RemoteState>> received_states;
-  uint64_t receiver_quench_timer;
+  StateMap<RemoteState> received_states;
+  bool rationalize_pending; /* states need the oldest one subtracted from them */
   RemoteState last_receiver_state; /* the state we were in when user last queried state */
   FragmentAssembly fragments;
   unsigned int verbose;
+  uint32_t remote_features; /* as advertised in the latest instruction */
 
 public:
   Transport( MyState& initial_state,
              RemoteState& initial_remote,
              const char* desired_ip,
-             const char* desired_port );
+             const char* desired_port,
+             Crypto::Algorithm algorithm = Crypto::AES_128_OCB );
   Transport( MyState& initial_state,
              RemoteState& initial_remote,
              const char* key_str,
@@ -118,6 +124,16 @@ public:
 
   void set_send_delay( int new_delay ) { sender.set_send_delay( new_delay ); }
 
+  /* Optional protocol features (Network::FEATURE_*) */
+  void set_features( uint32_t features ) { sender.set_features( features ); }
+  uint32_t get_remote_features( void ) const { return remote_features; }
+
+  /* Opt in to UDP segmentation and receive offload, where the kernel has them */
+  void set_udp_offload( bool enable ) { connection.set_udp_offload( enable ); }
+
+  /* Compression backend to use when the peer has it as well */
+  void set_compression( Compression compression ) { sender.set_compression( compression ); }
+
   uint64_t get_sent_state_acked_timestamp( void ) const { return sender.get_sent_state_acked_timestamp(); }
   uint64_t get_sent_state_acked( void ) const { return sender.get_sent_state_acked(); }
   uint64_t get_sent_state_last( void ) const { return sender.get_sent_state_last(); }
@@ -30,7 +30,10 @@
     also delete it here.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <utility>
 
 #include "compressor.h"
 #include "src/crypto/byteorder.h"
@@ -41,81 +44,80 @@
 using namespace Network;
 using namespace TransportBuffers;
 
-static std::string network_order_string( uint16_t host_order )
+size_t Fragment::write( char* out ) const
 {
-  uint16_t net_int = htobe16( host_order );
-  return std::string( (char*)&net_int, sizeof( net_int ) );
-}
-
-static std::string network_order_string( uint64_t host_order )
-{
-  uint64_t net_int = htobe64( host_order );
-  return std::string( (char*)&net_int, sizeof( net_int ) );
-}
-
-std::string Fragment::tostring( void )
-{
-  assert( initialized );
-
-  std::string ret;
-
-  ret += network_order_string( id );
+  uint64_t id_net = htobe64( id );
+  memcpy( out, &id_net, sizeof( id_net ) );
 
   fatal_assert(
     !( fragment_num & 0x8000 ) ); /* effective limit on size of a terminal screen change or buffered user input */
   uint16_t combined_fragment_num = ( final << 15 ) | fragment_num;
-  ret += network_order_string( combined_fragment_num );
+  uint16_t combined_net = htobe16( combined_fragment_num );
+  memcpy( out + sizeof( id_net ), &combined_net, sizeof( combined_net ) );
 
-  assert( ret.size() == frag_header_len );
+  memcpy( out + frag_header_len, contents, contents_len );
 
-  ret += contents;
-
-  return ret;
+  return frag_header_len + contents_len;
 }
 
-Fragment::Fragment( const std::string& x )
-  : id( -1 ), fragment_num( -1 ), final( false ), initialized( true ), contents()
+Fragment::Fragment( const char* data, size_t len )
+  : id( -1 ), fragment_num( -1 ), final( false ), contents( data + frag_header_len ),
+    contents_len( len - frag_header_len )
 {
-  fatal_assert( x.size() >= frag_header_len );
-  contents = std::string( x.begin() + frag_header_len, x.end() );
+  fatal_assert( len >= frag_header_len );
 
   uint64_t data64;
-  uint16_t* data16 = (uint16_t*)x.data();
-  memcpy( &data64, x.data(), sizeof( data64 ) );
+  uint16_t data16;
+  memcpy( &data64, data, sizeof( data64 ) );
+  memcpy( &data16, data + sizeof( data64 ), sizeof( data16 ) );
   id = be64toh( data64 );
-  fragment_num = be16toh( data16[4] );
+  fragment_num = be16toh( data16 );
   final = ( fragment_num & 0x8000 ) >> 15;
   fragment_num &= 0x7FFF;
 }
 
-bool FragmentAssembly::add_fragment( Fragment& frag )
+bool FragmentAssembly::add_fragment( const Fragment& frag, Instruction& assembly )
 {
+  /* an instruction in one fragment, as most are, is read where it arrived */
+  if ( frag.fragment_num == 0 && frag.final ) {
+    arrived.clear();
+    fragments_arrived = 0;
+    fragments_total = -1;
+    current_id = frag.id;
+    parse( frag.contents, frag.contents_len, assembly );
+    return true;
+  }
+
   /* see if this is a totally new packet */
   if ( current_id != frag.id ) {
-    fragments.clear();
-    fragments.resize( frag.fragment_num + 1 );
-    fragments.at( frag.fragment_num ) = frag;
-    fragments_arrived = 1;
+    arrived.assign( frag.fragment_num + 1, false );
+    fragments_arrived = 0;
     fragments_total = -1; /* unknown */
     current_id = frag.id;
-  } else { /* not a new packet */
-    /* see if we already have this fragment */
-    if ( ( fragments.size() > frag.fragment_num ) && ( fragments.at( frag.fragment_num ).initialized ) ) {
-      /* make sure new version is same as what we already have */
-      assert( fragments.at( frag.fragment_num ) == frag );
-    } else {
-      if ( (int)fragments.size() < frag.fragment_num + 1 ) {
-        fragments.resize( frag.fragment_num + 1 );
-      }
-      fragments.at( frag.fragment_num ) = frag;
-      fragments_arrived++;
-    }
+  }
+
+  if ( arrived.size() < size_t( frag.fragment_num ) + 1 ) {
+    arrived.resize( frag.fragment_num + 1, false );
+  }
+  if ( contents.size() < arrived.size() ) {
+    contents.resize( arrived.size() );
+  }
+
+  std::string& slot = contents[frag.fragment_num];
+  /* see if we already have this fragment */
+  if ( arrived[frag.fragment_num] ) {
+    /* make sure new version is same as what we already have */
+    assert( slot.size() == frag.contents_len && !memcmp( slot.data(), frag.contents, frag.contents_len ) );
+  } else {
+    slot.assign( frag.contents, frag.contents_len );
+    arrived[frag.fragment_num] = true;
+    fragments_arrived++;
   }
 
   if ( frag.final ) {
     fragments_total = frag.fragment_num + 1;
-    assert( (int)fragments.size() <= fragments_total );
-    fragments.resize( fragments_total );
+    assert( (int)arrived.size() <= fragments_total );
+    arrived.resize( fragments_total, false );
   }
 
   if ( fragments_total != -1 ) {
@@ -123,44 +125,42 @@ bool FragmentAssembly::add_fragment( Fragment& frag )
   }
 
   /* see if we're done */
-  return fragments_arrived == fragments_total;
-}
-
-Instruction FragmentAssembly::get_assembly( void )
-{
-  assert( fragments_arrived == fragments_total );
-
-  std::string encoded;
+  if ( fragments_arrived != fragments_total ) {
+    return false;
+  }
 
+  encoded.clear();
   for ( int i = 0; i < fragments_total; i++ ) {
-    assert( fragments.at( i ).initialized );
-    encoded += fragments.at( i ).contents;
+    encoded += contents[i];
   }
-
-  Instruction ret;
-  fatal_assert( ret.ParseFromString( get_compressor().uncompress_str( encoded ) ) );
-
-  fragments.clear();
+  arrived.clear();
   fragments_arrived = 0;
   fragments_total = -1;
 
-  return ret;
+  parse( encoded.data(), encoded.size(), assembly );
+  return true;
 }
 
-bool Fragment::operator==( const Fragment& x ) const
+void FragmentAssembly::parse( const char* data, size_t len, Instruction& assembly )
 {
-  return ( id == x.id ) && ( fragment_num == x.fragment_num ) && ( final == x.final )
-         && ( initialized == x.initialized ) && ( contents == x.contents );
+  fatal_assert( assembly.ParseFromString( compressor.uncompress_str( data, len ) ) );
 }
 
-std::vector<Fragment> Fragmenter::make_fragments( const Instruction& inst, size_t MTU )
+size_t Fragmenter::make_fragments( const Instruction& inst,
+                                   size_t MTU,
+                                   Compression compression,
+                                   uint32_t dictionary )
 {
   MTU -= Fragment::frag_header_len;
   if ( ( inst.old_num() != last_instruction.old_num() ) || ( inst.new_num() != last_instruction.new_num() )
        || ( inst.ack_num() != last_instruction.ack_num() )
        || ( inst.throwaway_num() != last_instruction.throwaway_num() )
        || ( inst.chaff() != last_instruction.chaff() )
-       || ( inst.protocol_version() != last_instruction.protocol_version() ) || ( last_MTU != MTU ) ) {
+       || ( inst.protocol_version() != last_instruction.protocol_version() ) || ( last_MTU != MTU )
+       || ( inst.history_reset() != last_instruction.history_reset() )
+       || ( inst.diff_compression() != last_instruction.diff_compression() )
+       || ( inst.diff() != last_instruction.diff() ) || ( last_compression != compression )
+       || ( last_dictionary != dictionary ) ) {
     next_instruction_id++;
   }
 
@@ -170,26 +170,17 @@ std::vector<Fragment> Fragmenter::make_fragments( const Instruction& inst, size_
 
   last_instruction = inst;
   last_MTU = MTU;
+  last_compression = compression;
+  last_dictionary = dictionary;
 
-  std::string payload = get_compressor().compress_str( inst.SerializeAsString() );
-  uint16_t fragment_num = 0;
-  std::vector<Fragment> ret;
-
-  while ( !payload.empty() ) {
-    std::string this_fragment;
-    bool final = false;
-
-    if ( payload.size() > MTU ) {
-      this_fragment = std::string( payload.begin(), payload.begin() + MTU );
-      payload = std::string( payload.begin() + MTU, payload.end() );
-    } else {
-      this_fragment = payload;
-      payload.clear();
-      final = true;
-    }
+  payload = compressor.compress_str( inst.SerializeAsString(), compression, dictionary );
 
-    ret.push_back( Fragment( next_instruction_id, fragment_num++, final, this_fragment ) );
-  }
+  return ( payload.size() + MTU - 1 ) / MTU;
+}
 
-  return ret;
+Fragment Fragmenter::fragment( size_t i ) const
+{
+  const size_t offset = i * last_MTU;
+  const size_t len = std::min( last_MTU, payload.size() - offset );
+  return Fragment( next_instruction_id, i, offset + len == payload.size(), payload.data() + offset, len );
 }
@@ -37,11 +37,14 @@
 #include <string>
 #include <vector>
 
+#include "src/network/compressor.h"
 #include "src/protobufs/transportinstruction.pb.h"
 
 namespace Network {
 using namespace TransportBuffers;
 
+/* A fragment's header, and where its contents are: in the datagram as
+   received, or in the compressed instruction being sent */
 class Fragment
 {
 public:
@@ -51,34 +54,43 @@ public:
   uint16_t fragment_num;
   bool final;
 
-  bool initialized;
+  const char* contents; /* not owned */
+  size_t contents_len;
 
-  std::string contents;
-
-  Fragment() : id( -1 ), fragment_num( -1 ), final( false ), initialized( false ), contents() {}
-
-  Fragment( uint64_t s_id, uint16_t s_fragment_num, bool s_final, const std::string& s_contents )
-    : id( s_id ), fragment_num( s_fragment_num ), final( s_final ), initialized( true ), contents( s_contents )
+  Fragment( uint64_t s_id, uint16_t s_fragment_num, bool s_final, const char* s_contents, size_t s_contents_len )
+    : id( s_id ), fragment_num( s_fragment_num ), final( s_final ), contents( s_contents ),
+      contents_len( s_contents_len )
   {}
 
-  Fragment( const std::string& x );
+  Fragment( const char* data, size_t len );
 
-  std::string tostring( void );
-
-  bool operator==( const Fragment& x ) const;
+  /* writes the fragment as sent at out, returning its length */
+  size_t write( char* out ) const;
 };
 
 class FragmentAssembly
 {
 private:
-  std::vector<Fragment> fragments;
+  /* contents of the fragments so far; the strings keep their memory from one instruction to the next */
+  std::vector<std::string> contents;
+  std::vector<bool> arrived;
+  std::string encoded;
   uint64_t current_id;
   int fragments_arrived, fragments_total;
+  Compressor compressor;
+
+  void parse( const char* data, size_t len, Instruction& assembly );
 
 public:
-  FragmentAssembly() : fragments(), current_id( -1 ), fragments_arrived( 0 ), fragments_total( -1 ) {}
-  bool add_fragment( Fragment& inst );
-  Instruction get_assembly( void );
+  FragmentAssembly()
+    : contents(), arrived(), encoded(), current_id( -1 ), fragments_arrived( 0 ), fragments_total( -1 ),
+      compressor()
+  {}
+  /* true, with the instruction in assembly, once frag completes one */
+  bool add_fragment( const Fragment& frag, Instruction& assembly );
+
+  /* also for what the instructions carry */
+  Compressor& get_compressor( void ) { return compressor; }
 };
 
 class Fragmenter
@@ -87,15 +99,30 @@ private:
   uint64_t next_instruction_id;
   Instruction last_instruction;
   size_t last_MTU;
+  Compression last_compression;
+  uint32_t last_dictionary;
+  Compressor compressor;
+  std::string payload; /* the last instruction, compressed */
 
 public:
-  Fragmenter() : next_instruction_id( 0 ), last_instruction(), last_MTU( -1 )
+  Fragmenter()
+    : next_instruction_id( 0 ), last_instruction(), last_MTU( -1 ), last_compression( COMPRESSION_ZLIB ),
+      last_dictionary( 0 ), compressor(), payload()
   {
     last_instruction.set_old_num( -1 );
     last_instruction.set_new_num( -1 );
   }
-  std::vector<Fragment> make_fragments( const Instruction& inst, size_t MTU );
+  /* returns how many fragments inst takes; fragment() gives each of them,
+     pointing into the compressed instruction until the next call */
+  size_t make_fragments( const Instruction& inst,
+                         size_t MTU,
+                         Compression compression = COMPRESSION_ZLIB,
+                         uint32_t dictionary = 0 );
+  Fragment fragment( size_t i ) const;
   uint64_t last_ack_sent( void ) const { return last_instruction.ack_num(); }
+
+  /* also for what the instructions carry */
+  Compressor& get_compressor( void ) { return compressor; }
 };
 
 }
@@ -40,6 +40,7 @@
 #include <ctime>
 #include <list>
 
+#include "src/network/compressor.h"
 #include "src/network/transportfragment.h"
 #include "src/network/transportsender.h"
 #include "src/util/fatal_assert.h"
@@ -49,11 +50,12 @@ using namespace Network;
 template<class MyState>
 TransportSender<MyState>::TransportSender( Connection* s_connection, MyState& initial_state )
   : connection( s_connection ), current_state( initial_state ),
-    sent_states( 1, TimestampedState<MyState>( timestamp(), 0, initial_state ) ),
-    assumed_receiver_state( sent_states.begin() ), fragmenter(), next_ack_time( timestamp() ),
+    sent_states( TimestampedState<MyState>( timestamp(), 0, initial_state ) ), assumed_receiver_state( 0 ),
+    rationalize_pending( true ), diff_cache(), fragmenter(), next_ack_time( timestamp() ),
     next_send_time( timestamp() ), verbose( 0 ), shutdown_in_progress( false ), shutdown_tries( 0 ),
     shutdown_start( -1 ), ack_num( 0 ), pending_data_ack( false ), SEND_MINDELAY( 8 ), last_heard( 0 ), prng(),
-    mindelay_clock( -1 )
+    mindelay_clock( -1 ), features( 0 ), remote_features( 0 ), diff_features( 0 ), compression( COMPRESSION_ZLIB ),
+    resync_num( 0 ), resync_heard( 0 ), resync_pending( false )
 {}
 
 /* Try to send roughly two frames per RTT, bounded by limits on frame rate */
@@ -92,7 +94,8 @@ void TransportSender<MyState>::calculate_timers( void )
     }
 
     next_send_time = std::max( mindelay_clock + SEND_MINDELAY, sent_states.back().timestamp + send_interval() );
-  } else if ( !( current_state == assumed_receiver_state->state ) && ( last_heard + ACTIVE_RETRY_TIMEOUT > now ) ) {
+  } else if ( !( current_state == sent_states[assumed_receiver_state].state )
+              && ( last_heard + ACTIVE_RETRY_TIMEOUT > now ) ) {
     next_send_time = sent_states.back().timestamp + send_interval();
     if ( mindelay_clock != uint64_t( -1 ) ) {
       next_send_time = std::max( next_send_time, mindelay_clock + SEND_MINDELAY );
@@ -151,13 +154,18 @@ void TransportSender<MyState>::tick( void )
 
   /* Determine if a new diff or empty ack needs to be sent */
 
-  std::string diff = current_state.diff_from( assumed_receiver_state->state );
+  std::string diff = diff_against( sent_states[assumed_receiver_state] );
 
   attempt_prospective_resend_optimization( diff );
 
+  if ( resync_pending ) { /* from the one state the receiver surely has */
+    assumed_receiver_state = 0;
+    diff = current_state.resync_diff( sent_states.front().state );
+  }
+
   if ( verbose ) {
     /* verify diff has round-trip identity (modulo Unicode fallback rendering) */
-    MyState newstate( assumed_receiver_state->state );
+    MyState newstate( sent_states[assumed_receiver_state].state );
     newstate.apply_string( diff );
     if ( current_state.compare( newstate ) ) {
       fprintf( stderr, "Warning, round-trip Instruction verification failed!\n" );
@@ -183,6 +191,7 @@ void TransportSender<MyState>::tick( void )
     /* Send diffs or ack */
     send_to_receiver( diff );
     mindelay_clock = uint64_t( -1 );
+    resync_pending = false;
   }
 }
 
@@ -202,7 +211,7 @@ void TransportSender<MyState>::send_empty_ack( void )
 
   //  sent_states.push_back( TimestampedState<MyState>( sent_states.back().timestamp, new_num, current_state ) );
   add_sent_state( now, new_num, current_state );
-  send_in_fragments( "", new_num );
+  send_in_fragments( "", new_num, false );
 
   next_ack_time = now + ACK_INTERVAL;
   next_send_time = uint64_t( -1 );
@@ -213,11 +222,11 @@ void TransportSender<MyState>::add_sent_state( uint64_t the_timestamp, uint64_t
 {
   sent_states.push_back( TimestampedState<MyState>( the_timestamp, num, state ) );
   if ( sent_states.size() > 32 ) { /* limit on state queue */
-    typename sent_states_type::iterator last = sent_states.end();
-    for ( int i = 0; i < 16; i++ ) {
-      last--;
+    const size_t middle = sent_states.size() - 16;
+    sent_states.erase( middle ); /* erase state from middle of queue */
+    if ( assumed_receiver_state > middle ) {
+      assumed_receiver_state--;
     }
-    sent_states.erase( last ); /* erase state from middle of queue */
   }
 }
 
@@ -236,18 +245,18 @@ void TransportSender<MyState>::send_to_receiver( const std::string& diff )
     new_num = uint64_t( -1 );
   }
 
-  if ( new_num == sent_states.back().num ) {
+  const bool resend = ( new_num == sent_states.back().num );
+  if ( resend ) {
     sent_states.back().timestamp = timestamp();
   } else {
     add_sent_state( timestamp(), new_num, current_state );
   }
 
-  send_in_fragments( diff, new_num ); // Can throw NetworkException
+  send_in_fragments( diff, new_num, resend ); // Can throw NetworkException
 
   /* successfully sent, probably */
   /* ("probably" because the FIRST size-exceeded datagram doesn't get an error) */
-  assumed_receiver_state = sent_states.end();
-  assumed_receiver_state--;
+  assumed_receiver_state = sent_states.size() - 1;
   next_ack_time = timestamp() + ACK_INTERVAL;
   next_send_time = uint64_t( -1 );
 }
@@ -258,37 +267,69 @@ void TransportSender<MyState>::update_assumed_receiver_state( void )
   uint64_t now = timestamp();
 
   /* start from what is known and give benefit of the doubt to unacknowledged states
-     transmitted recently enough ago */
-  assumed_receiver_state = sent_states.begin();
-
-  typename std::list<TimestampedState<MyState>>::iterator i = sent_states.begin();
-  i++;
+     transmitted recently enough ago.  Timestamps never decrease along the queue, so
+     if the oldest unacknowledged state is recent enough, so are all the others. */
+  assumed_receiver_state = 0;
 
-  while ( i != sent_states.end() ) {
-    assert( now >= i->timestamp );
+  if ( sent_states.size() > 1 ) {
+    const uint64_t oldest = sent_states[1].timestamp;
+    assert( now >= oldest );
 
-    if ( uint64_t( now - i->timestamp ) < connection->timeout() + ACK_DELAY ) {
-      assumed_receiver_state = i;
-    } else {
-      return;
+    if ( uint64_t( now - oldest ) < connection->timeout() + ACK_DELAY ) {
+      assumed_receiver_state = sent_states.size() - 1;
     }
-
-    i++;
   }
 }
 
 template<class MyState>
 void TransportSender<MyState>::rationalize_states( void )
 {
+  /* Once the known receiver state has been subtracted from itself, it is empty
+     and every later state starts after it; only a new one needs the work. */
+  if ( !rationalize_pending ) {
+    return;
+  }
+  rationalize_pending = false;
+
   const MyState* known_receiver_state = &sent_states.front().state;
 
   current_state.subtract( known_receiver_state );
 
-  for ( typename std::list<TimestampedState<MyState>>::reverse_iterator i = sent_states.rbegin();
-        i != sent_states.rend();
-        i++ ) {
-    i->state.subtract( known_receiver_state );
+  /* forget diffs from states older than the known receiver state; the rest
+     are unchanged by removing the common prefix from both of their states */
+  for ( typename std::list<DiffCacheEntry>::iterator i = diff_cache.begin(); i != diff_cache.end(); ) {
+    if ( i->from_num < sent_states.front().num ) {
+      i = diff_cache.erase( i );
+    } else {
+      i->to_state.subtract( known_receiver_state );
+      i++;
+    }
+  }
+
+  for ( size_t i = sent_states.size(); i-- > 0; ) {
+    sent_states[i].state.subtract( known_receiver_state );
+  }
+}
+
+/* Diff from a sent state to current_state, computing it only if we haven't already.
+   Sent state numbers are never reused for different contents, so the number
+   identifies the source and equality with a saved copy identifies the target. */
+template<class MyState>
+const std::string& TransportSender<MyState>::diff_against( const TimestampedState<MyState>& existing )
+{
+  for ( typename std::list<DiffCacheEntry>::iterator i = diff_cache.begin(); i != diff_cache.end(); i++ ) {
+    if ( i->from_num == existing.num && i->to_state == current_state ) {
+      /* move to front */
+      diff_cache.splice( diff_cache.begin(), diff_cache, i );
+      return diff_cache.front().diff;
+    }
+  }
+
+  diff_cache.push_front( DiffCacheEntry( existing.num, current_state, current_state.diff_from( existing.state ) ) );
+  if ( diff_cache.size() > DIFF_CACHE_SIZE ) {
+    diff_cache.pop_back();
   }
+  return diff_cache.front().diff;
 }
 
 template<class MyState>
@@ -303,39 +344,78 @@ const std::string TransportSender<MyState>::make_chaff( void )
 }
 
 template<class MyState>
-void TransportSender<MyState>::send_in_fragments( const std::string& diff, uint64_t new_num )
+void TransportSender<MyState>::send_in_fragments( const std::string& diff, uint64_t new_num, bool resend )
 {
   Instruction inst;
 
   inst.set_protocol_version( MOSH_PROTOCOL_VERSION );
-  inst.set_old_num( assumed_receiver_state->num );
+  inst.set_old_num( sent_states[assumed_receiver_state].num );
   inst.set_new_num( new_num );
   inst.set_ack_num( ack_num );
   inst.set_throwaway_num( sent_states.front().num );
-  inst.set_diff( diff );
+
+  /* Start the history afresh if we can't be sure of the receiver's.
+     A state sent again with a different history becomes uncertain,
+     since the receiver keeps whichever version arrives first. */
+  std::shared_ptr<const std::string> history = sent_states[assumed_receiver_state].history;
+  if ( !history ) {
+    history = std::make_shared<const std::string>();
+    inst.set_history_reset( true );
+  }
+  /* A state sent again from the same reference state has to carry the
+     same bytes, so it is encoded as it was when first sent. */
+  if ( !resend ) {
+    diff_features = remote_features;
+  }
+  const Compression method = negotiate_compression( compression, diff_features );
+  const uint32_t dictionary = ( diff_features & FEATURE_DICTIONARY ) ? DICTIONARY_VERSION : 0;
+  if ( ( diff_features & FEATURE_HISTORY ) && !diff.empty() ) {
+    inst.set_diff( fragmenter.get_compressor().compress_str( diff, *history, method, dictionary ) );
+    inst.set_diff_compression( method | dictionary << 4 );
+  } else {
+    inst.set_diff( diff );
+  }
+  history = next_history( history, diff );
+  TimestampedState<MyState>& target = sent_states.back();
+  if ( !resend ) {
+    target.history = history;
+  } else if ( target.history && ( *target.history != *history ) ) {
+    target.history.reset();
+  }
+
   inst.set_chaff( make_chaff() );
+  if ( features ) {
+    inst.set_features( features );
+  }
+  if ( resync_num > ack_num ) {
+    inst.set_resync_num( resync_num );
+  }
 
   if ( new_num == uint64_t( -1 ) ) {
     shutdown_tries++;
   }
 
-  std::vector<Fragment> fragments = fragmenter.make_fragments(
-    inst, connection->get_MTU() - Network::Connection::ADDED_BYTES - Crypto::Session::ADDED_BYTES );
-  for ( std::vector<Fragment>::iterator i = fragments.begin(); i != fragments.end(); i++ ) {
-    connection->send( i->tostring() );
+  const size_t MTU = connection->get_MTU() - Network::Connection::ADDED_BYTES - Crypto::Session::ADDED_BYTES;
+  const size_t fragments = fragmenter.make_fragments( inst, MTU, method, dictionary );
+  for ( size_t i = 0; i < fragments; i++ ) {
+    connection->add_payload( fragmenter.fragment( i ).write( connection->new_payload() ) );
+  }
+  connection->send();
 
+  for ( size_t i = 0; i < fragments; i++ ) {
     if ( verbose ) {
+      const Fragment frag = fragmenter.fragment( i );
       fprintf(
         stderr,
         "[%u] Sent [%d=>%d] id %d, frag %d ack=%d, throwaway=%d, len=%d, frame rate=%.2f, timeout=%d, srtt=%.1f\n",
         (unsigned int)( timestamp() % 100000 ),
         (int)inst.old_num(),
         (int)inst.new_num(),
-        (int)i->id,
-        (int)i->fragment_num,
+        (int)frag.id,
+        (int)frag.fragment_num,
         (int)inst.ack_num(),
         (int)inst.throwaway_num(),
-        (int)i->contents.size(),
+        (int)frag.contents_len,
         1000.0 / (double)send_interval(),
         (int)connection->timeout(),
         connection->get_SRTT() );
@@ -350,24 +430,14 @@ void TransportSender<MyState>::process_acknowledgment_through( uint64_t ack_num
 {
   /* Ignore ack if we have culled the state it's acknowledging */
 
-  typename sent_states_type::iterator i;
-  for ( i = sent_states.begin(); i != sent_states.end(); i++ ) {
-    if ( i->num == ack_num ) {
-      break;
-    }
+  const size_t i = sent_states.find( ack_num );
+  if ( i == sent_states.size() || i == 0 ) {
+    return;
   }
 
-  if ( i != sent_states.end() ) {
-    for ( i = sent_states.begin(); i != sent_states.end(); ) {
-      typename sent_states_type::iterator i_next = i;
-      i_next++;
-      if ( i->num < ack_num ) {
-        sent_states.erase( i );
-      }
-      i = i_next;
-    }
-  }
-  assert( !sent_states.empty() );
+  sent_states.pop_front( i );
+  assumed_receiver_state = assumed_receiver_state > i ? assumed_receiver_state - i : 0;
+  rationalize_pending = true;
 }
 
 /* give up on getting acknowledgement for shutdown */
@@ -397,11 +467,11 @@ void TransportSender<MyState>::set_ack_num( uint64_t s_ack_num )
 template<class MyState>
 void TransportSender<MyState>::attempt_prospective_resend_optimization( std::string& proposed_diff )
 {
-  if ( assumed_receiver_state == sent_states.begin() ) {
+  if ( assumed_receiver_state == 0 ) {
     return;
   }
 
-  std::string resend_diff = current_state.diff_from( sent_states.front().state );
+  const std::string& resend_diff = diff_against( sent_states.front() );
 
   /* We do a prophylactic resend if it would make the diff shorter,
      or if it would lengthen it by no more than 100 bytes and still be
@@ -409,7 +479,7 @@ void TransportSender<MyState>::attempt_prospective_resend_optimization( std::str
 
   if ( ( resend_diff.size() <= proposed_diff.size() )
        || ( ( resend_diff.size() < 1000 ) && ( resend_diff.size() - proposed_diff.size() < 100 ) ) ) {
-    assumed_receiver_state = sent_states.begin();
+    assumed_receiver_state = 0;
     proposed_diff = resend_diff;
   }
 }
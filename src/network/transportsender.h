@@ -37,6 +37,7 @@
 #include <string>
 
 #include "src/crypto/prng.h"
+#include "src/network/compressor.h"
 #include "src/network/network.h"
 #include "src/protobufs/transportinstruction.pb.h"
 #include "transportfragment.h"
@@ -63,21 +64,39 @@ private:
   void rationalize_states( void );
   void send_to_receiver( const std::string& diff );
   void send_empty_ack( void );
-  void send_in_fragments( const std::string& diff, uint64_t new_num );
+  void send_in_fragments( const std::string& diff, uint64_t new_num, bool resend );
   void add_sent_state( uint64_t the_timestamp, uint64_t num, MyState& state );
+  const std::string& diff_against( const TimestampedState<MyState>& existing );
 
   /* state of sender */
   Connection* connection;
 
   MyState current_state;
 
-  using sent_states_type = std::list<TimestampedState<MyState>>;
-  sent_states_type sent_states;
+  StateRing<MyState> sent_states;
   /* first element: known, acknowledged receiver state */
   /* last element: last sent state */
 
-  /* somewhere in the middle: the assumed state of the receiver */
-  typename sent_states_type::iterator assumed_receiver_state;
+  /* somewhere in the middle: the assumed state of the receiver (by position) */
+  size_t assumed_receiver_state;
+
+  /* states need the acknowledged state subtracted from them */
+  bool rationalize_pending;
+
+  /* memoized diffs from sent states (by number) to current_state, most recent first */
+  class DiffCacheEntry
+  {
+  public:
+    uint64_t from_num;
+    MyState to_state;
+    std::string diff;
+
+    DiffCacheEntry( uint64_t s_from_num, const MyState& s_to_state, const std::string& s_diff )
+      : from_num( s_from_num ), to_state( s_to_state ), diff( s_diff )
+    {}
+  };
+  static const size_t DIFF_CACHE_SIZE = 4;
+  std::list<DiffCacheEntry> diff_cache;
 
   /* for fragment creation */
   Fragmenter fragmenter;
@@ -107,6 +126,17 @@ private:
 
   uint64_t mindelay_clock; /* time of first pending change to current state */
 
+  uint32_t features;        /* advertised to the receiver */
+  uint32_t remote_features; /* advertised by the receiver */
+  uint32_t diff_features;   /* remote_features when the newest state was first sent */
+  Compression compression;  /* preferred, if the receiver has it */
+
+  /* as receiver: a state we could not verify, asked about until we move past it */
+  uint64_t resync_num;
+  /* as sender: the latest such state we heard about, and whether a full diff is owed */
+  uint64_t resync_heard;
+  bool resync_pending;
+
 public:
   /* constructor */
   TransportSender( Connection* s_connection, MyState& initial_state );
@@ -150,6 +180,7 @@ public:
     assert( !shutdown_in_progress );
     current_state = x;
     current_state.reset_input();
+    rationalize_pending = true;
   }
   void set_verbose( unsigned int s_verbose ) { verbose = s_verbose; }
 
@@ -164,6 +195,27 @@ public:
 
   void set_send_delay( int new_delay ) { SEND_MINDELAY = new_delay; }
 
+  void set_features( uint32_t s_features ) { features = s_features; }
+  void set_remote_features( uint32_t s_remote_features ) { remote_features = s_remote_features; }
+  void set_compression( Compression s_compression ) { compression = s_compression; }
+
+  /* The receiver of our state could not verify state num; send it a full diff */
+  void process_resync_request( uint64_t num )
+  {
+    if ( num > resync_heard ) {
+      resync_heard = num;
+      resync_pending = true;
+      pending_data_ack = true;
+    }
+  }
+
+  /* We could not verify the remote state num; ask for a full diff */
+  void set_resync_num( uint64_t num )
+  {
+    resync_num = num;
+    pending_data_ack = true;
+  }
+
   unsigned int send_interval( void ) const;
 
   /* nonexistent methods to satisfy -Weffc++ */
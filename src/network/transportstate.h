@@ -33,6 +33,12 @@
 #ifndef TRANSPORT_STATE_HPP
 #define TRANSPORT_STATE_HPP
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace Network {
 template<class State>
 class TimestampedState
@@ -42,10 +48,193 @@ public:
   uint64_t num;
   State state;
 
+  /* recent diffs leading to this state, which sender and receiver
+     both use as a compression dictionary; for the sender, NULL when
+     it cannot be sure which history the receiver holds */
+  std::shared_ptr<const std::string> history;
+
   TimestampedState( uint64_t s_timestamp, uint64_t s_num, const State& s_state )
-    : timestamp( s_timestamp ), num( s_num ), state( s_state )
+    : timestamp( s_timestamp ), num( s_num ), state( s_state ), history( std::make_shared<const std::string>() )
   {}
 };
+
+/* Timestamped states in increasing order of number, in a ring that
+   grows as needed.  Numbers are consecutive unless states were culled
+   from the middle, so a state is usually found at its distance from
+   the newest without searching. */
+template<class State>
+class StateRing
+{
+public:
+  using value_type = TimestampedState<State>;
+
+private:
+  std::vector<std::unique_ptr<value_type>> ring; /* size is a power of two */
+  size_t head, count;
+
+  std::unique_ptr<value_type>& slot( size_t i ) { return ring[( head + i ) & ( ring.size() - 1 )]; }
+  const std::unique_ptr<value_type>& slot( size_t i ) const { return ring[( head + i ) & ( ring.size() - 1 )]; }
+
+public:
+  explicit StateRing( const value_type& first ) : ring( 8 ), head( 0 ), count( 0 ) { push_back( first ); }
+
+  size_t size( void ) const { return count; }
+  value_type& operator[]( size_t i ) { return *slot( i ); }
+  const value_type& operator[]( size_t i ) const { return *slot( i ); }
+  value_type& front( void ) { return *slot( 0 ); }
+  const value_type& front( void ) const { return *slot( 0 ); }
+  value_type& back( void ) { return *slot( count - 1 ); }
+  const value_type& back( void ) const { return *slot( count - 1 ); }
+
+  void push_back( const value_type& x )
+  {
+    if ( count == ring.size() ) {
+      std::vector<std::unique_ptr<value_type>> bigger( 2 * ring.size() );
+      for ( size_t i = 0; i < count; i++ ) {
+        bigger[i] = std::move( slot( i ) );
+      }
+      ring.swap( bigger );
+      head = 0;
+    }
+    slot( count ) = std::make_unique<value_type>( x );
+    count++;
+  }
+
+  /* drop the n oldest states */
+  void pop_front( size_t n )
+  {
+    for ( size_t i = 0; i < n; i++ ) {
+      slot( i ).reset();
+    }
+    head = ( head + n ) & ( ring.size() - 1 );
+    count -= n;
+  }
+
+  /* drop the state at position i, moving the newer ones down */
+  void erase( size_t i )
+  {
+    for ( ; i + 1 < count; i++ ) {
+      slot( i ) = std::move( slot( i + 1 ) );
+    }
+    slot( count - 1 ).reset();
+    count--;
+  }
+
+  /* position of the state numbered num, or size() if there is none */
+  size_t find( uint64_t num ) const
+  {
+    if ( count == 0 || num > back().num ) {
+      return count;
+    }
+    const uint64_t distance = back().num - num;
+    if ( distance < count && slot( count - 1 - distance )->num == num ) {
+      return count - 1 - distance;
+    }
+
+    size_t low = 0, high = count;
+    while ( low < high ) {
+      const size_t mid = low + ( high - low ) / 2;
+      if ( slot( mid )->num < num ) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return ( low < count && slot( low )->num == num ) ? low : count;
+  }
+};
+
+/* Timestamped states sorted by number in a flat map of shared
+   snapshots, so lookup is a binary search, inserting in the middle
+   moves only pointers, and a state stays valid while it is in use
+   even if the map lets go of it. */
+template<class State>
+class StateMap
+{
+public:
+  using value_type = TimestampedState<State>;
+  using pointer = std::shared_ptr<value_type>;
+
+private:
+  std::vector<pointer> states;
+  std::vector<size_t> footprints; /* of each state, as last counted */
+  size_t bytes;                   /* approximate memory held */
+
+  typename std::vector<pointer>::iterator lower_bound( uint64_t num )
+  {
+    return std::lower_bound(
+      states.begin(), states.end(), num, []( const pointer& x, uint64_t n ) { return x->num < n; } );
+  }
+
+  /* A state usually shares much of what it holds with the one before
+     it, which it was made from or which was made from the same state,
+     so each is counted without what it shares with its predecessor. */
+  void recount( size_t i )
+  {
+    const value_type& x = *states[i];
+    const value_type* previous = i > 0 ? states[i - 1].get() : NULL;
+    size_t footprint = sizeof( x ) + x.state.memory( previous ? &previous->state : NULL );
+    if ( x.history && !( previous && previous->history == x.history ) ) {
+      footprint += x.history->size();
+    }
+    bytes = bytes - footprints[i] + footprint;
+    footprints[i] = footprint;
+  }
+
+public:
+  explicit StateMap( const value_type& first )
+    : states( 1, std::make_shared<value_type>( first ) ), footprints( 1, 0 ), bytes( 0 )
+  {
+    recount( 0 );
+  }
+
+  size_t size( void ) const { return states.size(); }
+  size_t memory( void ) const { return bytes; }
+  value_type& operator[]( size_t i ) { return *states[i]; }
+  const value_type& front( void ) const { return *states.front(); }
+  const value_type& back( void ) const { return *states.back(); }
+
+  /* the state numbered num, or NULL */
+  pointer find( uint64_t num )
+  {
+    typename std::vector<pointer>::iterator i = lower_bound( num );
+    return ( i != states.end() && ( *i )->num == num ) ? *i : pointer();
+  }
+
+  /* position of a state not already present */
+  size_t insert( const pointer& x )
+  {
+    const size_t i = lower_bound( x->num ) - states.begin();
+    states.insert( states.begin() + i, x );
+    footprints.insert( footprints.begin() + i, 0 );
+    recount( i );
+    if ( i + 1 < states.size() ) {
+      recount( i + 1 );
+    }
+    return i;
+  }
+
+  /* drop the states at positions [first, last) */
+  void erase( size_t first, size_t last )
+  {
+    for ( size_t i = first; i < last; i++ ) {
+      bytes -= footprints[i];
+    }
+    states.erase( states.begin() + first, states.begin() + last );
+    footprints.erase( footprints.begin() + first, footprints.begin() + last );
+    if ( first < states.size() ) {
+      recount( first );
+    }
+  }
+
+  /* drop the states numbered below num, returning how many */
+  size_t erase_before( uint64_t num )
+  {
+    const size_t n = lower_bound( num ) - states.begin();
+    erase( 0, n );
+    return n;
+  }
+};
 }
 
 #endif
@@ -31,6 +31,9 @@
 */
 
 #include <climits>
+#include <cwchar>
+#include <map>
+#include <unordered_map>
 
 #include "src/protobufs/hostinput.pb.h"
 #include "src/statesync/completeterminal.h"
@@ -41,9 +44,20 @@ using namespace Parser;
 using namespace Terminal;
 using namespace HostBuffers;
 
-string Complete::act( const string& str )
+/* Printable ASCII in the ground state, which is most of any output,
+   goes straight to the emulator without allocating parser actions. */
+void Complete::parse( const string& str )
 {
+  Print print;
+  print.char_present = true;
+
   for ( unsigned int i = 0; i < str.size(); i++ ) {
+    if ( ( 0x20 <= str[i] ) && ( str[i] <= 0x7e ) && parser.is_ground() ) {
+      print.ch = str[i];
+      print.act_on_terminal( &terminal );
+      continue;
+    }
+
     /* parse octet into up to three actions */
     parser.input( str[i], actions );
 
@@ -54,7 +68,11 @@ string Complete::act( const string& str )
     }
     actions.clear();
   }
+}
 
+string Complete::act( const string& str )
+{
+  parse( str );
   return terminal.read_octets_to_host();
 }
 
@@ -65,8 +83,348 @@ string Complete::act( const Action& act )
   return terminal.read_octets_to_host();
 }
 
+/* Structured screen deltas */
+
+/* a run of differing cells may absorb this many unchanged ones */
+static const int RUN_GAP_MAX = 4;
+
+enum
+{
+  CELL_WIDE = 1,
+  CELL_FALLBACK = 2,
+  CELL_WRAP = 4
+};
+
+static string encode_title( const Framebuffer::title_type& title )
+{
+  string ret;
+  for ( Framebuffer::title_type::const_iterator i = title.begin(); i != title.end(); i++ ) {
+    Cell::append_to_str( ret, *i );
+  }
+  return ret;
+}
+
+static Framebuffer::title_type decode_title( const string& s )
+{
+  Framebuffer::title_type ret;
+  mbstate_t ps = mbstate_t();
+  size_t i = 0;
+  while ( i < s.size() ) {
+    wchar_t c;
+    size_t len = mbrtowc( &c, s.data() + i, s.size() - i, &ps );
+    if ( ( len == 0 ) || ( len > s.size() - i ) ) { /* NUL, or invalid or truncated sequence */
+      break;
+    }
+    ret.push_back( c );
+    i += len;
+  }
+  return ret;
+}
+
+class Palette
+{
+private:
+  ScreenDelta* delta;
+  map<uint64_t, uint32_t> index;
+
+  /* not implemented */
+  Palette( const Palette& );
+  Palette& operator=( const Palette& );
+
+public:
+  Palette( ScreenDelta* s_delta ) : delta( s_delta ), index() {}
+
+  uint32_t lookup( const Renditions& r )
+  {
+    const uint64_t packed = r.pack();
+    map<uint64_t, uint32_t>::const_iterator it = index.find( packed );
+    if ( it != index.end() ) {
+      return it->second;
+    }
+    const uint32_t ret = delta->rendition_size();
+    delta->add_rendition( packed );
+    index[packed] = ret;
+    return ret;
+  }
+};
+
+static void add_run( ScreenDelta* delta, Palette& palette, int row, const Row& r, int start, int end )
+{
+  CellRun* run = delta->add_run();
+  run->set_row( row );
+  run->set_col( start );
+  run->set_rendition( palette.lookup( r.cells[start].get_renditions() ) );
+  run->set_count( end - start );
+
+  bool all_single = true, all_empty = true, any_flags = false;
+  for ( int x = start; x < end; x++ ) {
+    const Cell& cell = r.cells[x];
+    all_single = all_single && ( cell.get_contents().size() == 1 );
+    all_empty = all_empty && cell.empty();
+    any_flags = any_flags || cell.get_wide() || cell.get_fallback() || cell.get_wrap();
+  }
+
+  string* contents = run->mutable_contents();
+  for ( int x = start; x < end; x++ ) {
+    const Cell& cell = r.cells[x];
+    contents->append( cell.get_contents().begin(), cell.get_contents().end() );
+    if ( !all_single && !all_empty ) {
+      run->add_length( cell.get_contents().size() );
+    }
+    if ( any_flags ) {
+      run->add_flags( ( cell.get_wide() ? CELL_WIDE : 0 ) | ( cell.get_fallback() ? CELL_FALLBACK : 0 )
+                      | ( cell.get_wrap() ? CELL_WRAP : 0 ) );
+    }
+  }
+}
+
+/* Describe the changes from one row to another as runs of cells sharing a rendition. */
+static void diff_row( ScreenDelta* delta, Palette& palette, int row, const Row& old_row, const Row& new_row )
+{
+  const int width = new_row.cells.size();
+  int x = 0;
+  while ( x < width ) {
+    if ( new_row.cells[x] == old_row.cells[x] ) {
+      x++;
+      continue;
+    }
+
+    const Renditions& renditions = new_row.cells[x].get_renditions();
+    int end = x + 1;
+    for ( int scan = x + 1; ( scan < width ) && ( scan - end < RUN_GAP_MAX ); scan++ ) {
+      if ( !( new_row.cells[scan].get_renditions() == renditions ) ) {
+        break;
+      }
+      if ( new_row.cells[scan] != old_row.cells[scan] ) {
+        end = scan + 1;
+      }
+    }
+
+    add_run( delta, palette, row, new_row, x, end );
+    x = end;
+  }
+}
+
+/* old_fb must already have the dimensions of new_fb.  origin, if
+   known, gives the row of old_fb that each row of new_fb came from. */
+static void diff_screen( ScreenDelta* delta,
+                         const Framebuffer& old_fb,
+                         const Framebuffer& new_fb,
+                         const vector<int>* origin )
+{
+  const Framebuffer::rows_type& old_rows = old_fb.get_rows();
+  const Framebuffer::rows_type& new_rows = new_fb.get_rows();
+  const int height = new_fb.ds.get_height();
+  Palette palette( delta );
+
+  /* Otherwise, rows keep their identity when they scroll; one that was
+     also modified keeps its generation, unless that is shared with others. */
+  unordered_map<const Row*, int> old_ptrs;
+  unordered_map<uint64_t, int> old_gens;
+  for ( int y = 0; ( y < height ) && !origin; y++ ) {
+    old_ptrs.emplace( old_rows[y].get(), y );
+    pair<unordered_map<uint64_t, int>::iterator, bool> ins = old_gens.emplace( old_rows[y]->gen, y );
+    if ( !ins.second ) {
+      ins.first->second = -1;
+    }
+  }
+
+  for ( int y = 0; y < height; y++ ) {
+    if ( new_rows[y] == old_rows[y] ) {
+      continue;
+    }
+
+    int src = y;
+    if ( origin ) {
+      if ( ( *origin )[y] >= 0 ) {
+        src = ( *origin )[y];
+      }
+    } else {
+      unordered_map<const Row*, int>::const_iterator ptr = old_ptrs.find( new_rows[y].get() );
+      if ( ptr != old_ptrs.end() ) {
+        src = ptr->second;
+      } else if ( new_rows[y]->gen != old_rows[y]->gen ) {
+        unordered_map<uint64_t, int>::const_iterator gen = old_gens.find( new_rows[y]->gen );
+        if ( ( gen != old_gens.end() ) && ( gen->second >= 0 ) ) {
+          src = gen->second;
+        }
+      }
+    }
+
+    if ( src != y ) {
+      RowCopy* last = delta->copy_size() ? delta->mutable_copy( delta->copy_size() - 1 ) : NULL;
+      if ( last && ( last->dest() + last->count() == y ) && ( last->src() + last->count() == src ) ) {
+        last->set_count( last->count() + 1 );
+      } else {
+        RowCopy* copy = delta->add_copy();
+        copy->set_dest( y );
+        copy->set_src( src );
+        copy->set_count( 1 );
+      }
+    }
+
+    /* rows are copied before being written, so an unchanged one is still shared */
+    if ( new_rows[y] != old_rows[src] ) {
+      diff_row( delta, palette, y, *old_rows[src], *new_rows[y] );
+    }
+  }
+
+  const DrawState& o = old_fb.ds;
+  const DrawState& n = new_fb.ds;
+  ScreenState state;
+  if ( o.get_cursor_row() != n.get_cursor_row() ) {
+    state.set_cursor_row( n.get_cursor_row() );
+  }
+  if ( o.get_cursor_col() != n.get_cursor_col() ) {
+    state.set_cursor_col( n.get_cursor_col() );
+  }
+  if ( o.cursor_visible != n.cursor_visible ) {
+    state.set_cursor_visible( n.cursor_visible );
+  }
+  if ( o.reverse_video != n.reverse_video ) {
+    state.set_reverse_video( n.reverse_video );
+  }
+  if ( !( o.get_renditions() == n.get_renditions() ) ) {
+    state.set_rendition( n.get_renditions().pack() );
+  }
+  if ( o.bracketed_paste != n.bracketed_paste ) {
+    state.set_bracketed_paste( n.bracketed_paste );
+  }
+  if ( o.mouse_reporting_mode != n.mouse_reporting_mode ) {
+    state.set_mouse_reporting_mode( n.mouse_reporting_mode );
+  }
+  if ( o.mouse_focus_event != n.mouse_focus_event ) {
+    state.set_mouse_focus_event( n.mouse_focus_event );
+  }
+  if ( o.mouse_alternate_scroll != n.mouse_alternate_scroll ) {
+    state.set_mouse_alternate_scroll( n.mouse_alternate_scroll );
+  }
+  if ( o.mouse_encoding_mode != n.mouse_encoding_mode ) {
+    state.set_mouse_encoding_mode( n.mouse_encoding_mode );
+  }
+  if ( old_fb.is_title_initialized() != new_fb.is_title_initialized() ) {
+    state.set_title_initialized( new_fb.is_title_initialized() );
+  }
+  if ( old_fb.get_icon_name() != new_fb.get_icon_name() ) {
+    state.set_icon_name( encode_title( new_fb.get_icon_name() ) );
+  }
+  if ( old_fb.get_window_title() != new_fb.get_window_title() ) {
+    state.set_window_title( encode_title( new_fb.get_window_title() ) );
+  }
+  if ( old_fb.get_clipboard() != new_fb.get_clipboard() ) {
+    state.set_clipboard( encode_title( new_fb.get_clipboard() ) );
+  }
+  if ( old_fb.get_bell_count() != new_fb.get_bell_count() ) {
+    state.set_bell( true );
+  }
+  if ( !state.SerializeAsString().empty() ) {
+    delta->mutable_state()->Swap( &state );
+  }
+}
+
+static void apply_screen_delta( const ScreenDelta& delta, Framebuffer& fb )
+{
+  if ( delta.full() ) {
+    fb.reset();
+  }
+  const Framebuffer::rows_type old_rows( fb.get_rows() );
+  const int height = fb.ds.get_height();
+  const int width = fb.ds.get_width();
+
+  for ( int i = 0; i < delta.copy_size(); i++ ) {
+    const RowCopy& copy = delta.copy( i );
+    fatal_assert( ( copy.dest() >= 0 ) && ( copy.src() >= 0 ) && ( copy.count() >= 0 )
+                  && ( copy.dest() <= height - copy.count() ) && ( copy.src() <= height - copy.count() ) );
+    for ( int j = 0; j < copy.count(); j++ ) {
+      fb.set_row( copy.dest() + j, old_rows[copy.src() + j] );
+    }
+  }
+
+  for ( int i = 0; i < delta.run_size(); i++ ) {
+    const CellRun& run = delta.run( i );
+    const int count = run.count();
+    fatal_assert( ( run.row() >= 0 ) && ( run.row() < height ) && ( run.col() >= 0 ) && ( count >= 0 )
+                  && ( run.col() <= width - count ) && ( run.rendition() < uint32_t( delta.rendition_size() ) ) );
+    fatal_assert( ( run.length_size() == 0 ) || ( run.length_size() == count ) );
+    fatal_assert( ( run.flags_size() == 0 ) || ( run.flags_size() == count ) );
+    fatal_assert( ( run.length_size() > 0 ) || run.contents().empty()
+                  || ( run.contents().size() == size_t( count ) ) );
+
+    const Renditions renditions( Renditions::unpack( delta.rendition( run.rendition() ) ) );
+    const string& contents = run.contents();
+    size_t offset = 0;
+    Row* row = fb.get_mutable_row( run.row() );
+    for ( int j = 0; j < count; j++ ) {
+      size_t len = contents.empty() ? 0 : 1;
+      if ( run.length_size() ) {
+        len = run.length( j );
+      }
+      fatal_assert( len <= contents.size() - offset );
+
+      Cell& cell = row->cells[run.col() + j];
+      cell.set_contents( contents.data() + offset, len );
+      offset += len;
+      cell.set_renditions( renditions );
+      const uint32_t flags = run.flags_size() ? run.flags( j ) : 0;
+      cell.set_wide( flags & CELL_WIDE );
+      cell.set_fallback( flags & CELL_FALLBACK );
+      cell.set_wrap( flags & CELL_WRAP );
+    }
+  }
+
+  if ( !delta.has_state() ) {
+    return;
+  }
+  const ScreenState& state = delta.state();
+  if ( state.has_cursor_row() ) {
+    fb.ds.move_row( state.cursor_row() );
+  }
+  if ( state.has_cursor_col() ) {
+    fb.ds.move_col( state.cursor_col() );
+  }
+  if ( state.has_cursor_visible() ) {
+    fb.ds.cursor_visible = state.cursor_visible();
+  }
+  if ( state.has_reverse_video() ) {
+    fb.ds.reverse_video = state.reverse_video();
+  }
+  if ( state.has_rendition() ) {
+    fb.ds.get_renditions() = Renditions::unpack( state.rendition() );
+  }
+  if ( state.has_bracketed_paste() ) {
+    fb.ds.bracketed_paste = state.bracketed_paste();
+  }
+  if ( state.has_mouse_reporting_mode() ) {
+    fb.ds.mouse_reporting_mode = DrawState::MouseReportingMode( state.mouse_reporting_mode() );
+  }
+  if ( state.has_mouse_focus_event() ) {
+    fb.ds.mouse_focus_event = state.mouse_focus_event();
+  }
+  if ( state.has_mouse_alternate_scroll() ) {
+    fb.ds.mouse_alternate_scroll = state.mouse_alternate_scroll();
+  }
+  if ( state.has_mouse_encoding_mode() ) {
+    fb.ds.mouse_encoding_mode = DrawState::MouseEncodingMode( state.mouse_encoding_mode() );
+  }
+  if ( state.title_initialized() ) {
+    fb.set_title_initialized();
+  }
+  if ( state.has_icon_name() ) {
+    fb.set_icon_name( decode_title( state.icon_name() ) );
+  }
+  if ( state.has_window_title() ) {
+    fb.set_window_title( decode_title( state.window_title() ) );
+  }
+  if ( state.has_clipboard() ) {
+    fb.set_clipboard( decode_title( state.clipboard() ) );
+  }
+  if ( state.bell() ) {
+    fb.ring_bell();
+  }
+}
+
 /* interface for Network::Transport */
-string Complete::diff_from( const Complete& existing ) const
+string Complete::diff_from( const Complete& existing, bool full ) const
 {
   HostBuffers::HostMessage output;
 
@@ -76,17 +434,56 @@ string Complete::diff_from( const Complete& existing ) const
     new_echo->MutableExtension( echoack )->set_echo_ack_num( get_echo_ack() );
   }
 
-  if ( !( existing.get_fb() == get_fb() ) ) {
-    if ( ( existing.get_fb().ds.get_width() != terminal.get_fb().ds.get_width() )
-         || ( existing.get_fb().ds.get_height() != terminal.get_fb().ds.get_height() ) ) {
+  /* a full delta redraws everything, in case the client's frame has drifted from ours */
+  full = full && screen_delta;
+
+  if ( full || !( existing.get_fb() == get_fb() ) ) {
+    const bool resized = ( existing.get_fb().ds.get_width() != terminal.get_fb().ds.get_width() )
+                         || ( existing.get_fb().ds.get_height() != terminal.get_fb().ds.get_height() );
+    if ( resized ) {
       Instruction* new_res = output.add_instruction();
       new_res->MutableExtension( resize )->set_width( terminal.get_fb().ds.get_width() );
       new_res->MutableExtension( resize )->set_height( terminal.get_fb().ds.get_height() );
     }
-    string update = display.new_frame( true, existing.get_fb(), terminal.get_fb() );
-    if ( !update.empty() ) {
-      Instruction* new_inst = output.add_instruction();
-      new_inst->MutableExtension( hostbytes )->set_hoststring( update );
+    if ( screen_delta ) {
+      /* the delta applies to the previous frame as resized by the client */
+      ScreenDelta delta;
+      if ( full ) {
+        Framebuffer old_fb( terminal.get_fb() );
+        old_fb.reset();
+        diff_screen( &delta, old_fb, terminal.get_fb(), NULL );
+        ScreenState* state = delta.mutable_state();
+        state->set_icon_name( encode_title( terminal.get_fb().get_icon_name() ) );
+        state->set_window_title( encode_title( terminal.get_fb().get_window_title() ) );
+        state->set_clipboard( encode_title( terminal.get_fb().get_clipboard() ) );
+        delta.set_full( true );
+      } else if ( resized ) {
+        Framebuffer old_fb( existing.get_fb() );
+        old_fb.resize( terminal.get_fb().ds.get_width(), terminal.get_fb().ds.get_height() );
+        diff_screen( &delta, old_fb, terminal.get_fb(), NULL );
+      } else {
+        /* without having to search for rows that scrolled, if the journal goes back far enough */
+        const Journal* journal = journal_mark.get_journal();
+        vector<int> origin;
+        const bool journaled = journal && ( journal == existing.journal_mark.get_journal() )
+                               && journal->origins( existing.journal_mark.get_seq(),
+                                                    journal_mark.get_seq(),
+                                                    terminal.get_fb().ds.get_height(),
+                                                    origin );
+        diff_screen( &delta, existing.get_fb(), terminal.get_fb(), journaled ? &origin : NULL );
+      }
+      if ( delta.rendition_size() || delta.copy_size() || delta.run_size() || delta.has_state() ) {
+        output.add_instruction()->MutableExtension( screendelta )->Swap( &delta );
+      }
+      if ( digest ) {
+        output.add_instruction()->MutableExtension( HostBuffers::digest )->set_digest( terminal.get_fb().digest() );
+      }
+    } else {
+      string update = display.new_frame( true, existing.get_fb(), terminal.get_fb() );
+      if ( !update.empty() ) {
+        Instruction* new_inst = output.add_instruction();
+        new_inst->MutableExtension( hostbytes )->set_hoststring( update );
+      }
     }
   }
 
@@ -98,24 +495,31 @@ string Complete::init_diff( void ) const
   return diff_from( Complete( get_fb().ds.get_width(), get_fb().ds.get_height() ) );
 }
 
-void Complete::apply_string( const string& diff )
+bool Complete::apply_string( const string& diff )
 {
   HostBuffers::HostMessage input;
   fatal_assert( input.ParseFromString( diff ) );
+  bool verified = true;
 
   for ( int i = 0; i < input.instruction_size(); i++ ) {
     if ( input.instruction( i ).HasExtension( hostbytes ) ) {
-      string terminal_to_host = act( input.instruction( i ).GetExtension( hostbytes ).hoststring() );
-      assert( terminal_to_host.empty() ); /* server never interrogates client terminal */
+      /* no octets to host to collect: server never interrogates client terminal */
+      parse( input.instruction( i ).GetExtension( hostbytes ).hoststring() );
     } else if ( input.instruction( i ).HasExtension( resize ) ) {
       act( Resize( input.instruction( i ).GetExtension( resize ).width(),
                    input.instruction( i ).GetExtension( resize ).height() ) );
+    } else if ( input.instruction( i ).HasExtension( screendelta ) ) {
+      apply_screen_delta( input.instruction( i ).GetExtension( screendelta ), terminal.get_mutable_fb() );
     } else if ( input.instruction( i ).HasExtension( echoack ) ) {
       uint64_t inst_echo_ack_num = input.instruction( i ).GetExtension( echoack ).echo_ack_num();
       assert( inst_echo_ack_num >= echo_ack );
       echo_ack = inst_echo_ack_num;
+    } else if ( input.instruction( i ).HasExtension( HostBuffers::digest ) ) {
+      verified = verified
+                 && ( input.instruction( i ).GetExtension( HostBuffers::digest ).digest() == get_fb().digest() );
     }
   }
+  return verified;
 }
 
 bool Complete::operator==( Complete const& x ) const
@@ -126,27 +530,17 @@ bool Complete::operator==( Complete const& x ) const
 
 bool Complete::set_echo_ack( uint64_t now )
 {
-  bool ret = false;
-  uint64_t newest_echo_ack = 0;
-
-  for ( input_history_type::const_iterator i = input_history.begin(); i != input_history.end(); i++ ) {
-    if ( i->second <= now - ECHO_TIMEOUT ) {
-      newest_echo_ack = i->first;
-    }
+  /* keep only the newest frame that has had ECHO_TIMEOUT to be echoed, and those after it */
+  while ( ( input_history.size() >= 2 ) && ( input_history.at( 1 ).second <= now - ECHO_TIMEOUT ) ) {
+    input_history.pop_front();
   }
 
-  for ( input_history_type::iterator i = input_history.begin(); i != input_history.end(); ) {
-    input_history_type::iterator i_next = i;
-    i_next++;
-    if ( i->first < newest_echo_ack ) {
-      input_history.erase( i );
-    }
-    i = i_next;
+  uint64_t newest_echo_ack = echo_ack;
+  if ( ( input_history.size() > 0 ) && ( input_history.at( 0 ).second <= now - ECHO_TIMEOUT ) ) {
+    newest_echo_ack = input_history.at( 0 ).first;
   }
 
-  if ( echo_ack != newest_echo_ack ) {
-    ret = true;
-  }
+  bool ret = ( echo_ack != newest_echo_ack );
 
   echo_ack = newest_echo_ack;
 
@@ -155,7 +549,7 @@ bool Complete::set_echo_ack( uint64_t now )
 
 void Complete::register_input_frame( uint64_t n, uint64_t now )
 {
-  input_history.push_back( std::make_pair( n, now ) );
+  input_history.push_back( n, now );
 }
 
 int Complete::wait_time( uint64_t now ) const
@@ -164,10 +558,7 @@ int Complete::wait_time( uint64_t now ) const
     return INT_MAX;
   }
 
-  input_history_type::const_iterator it = input_history.begin();
-  it++;
-
-  uint64_t next_echo_ack_time = it->second + ECHO_TIMEOUT;
+  uint64_t next_echo_ack_time = input_history.at( 1 ).second + ECHO_TIMEOUT;
   if ( next_echo_ack_time <= now ) {
     return 0;
   }
@@ -34,7 +34,9 @@
 #define COMPLETE_TERMINAL_HPP
 
 #include <cstdint>
-#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "src/terminal/parser.h"
 #include "src/terminal/terminal.h"
@@ -42,6 +44,77 @@
 /* This class represents the complete terminal -- a UTF8Parser feeding Actions to an Emulator. */
 
 namespace Terminal {
+/* Frame numbers of recent user input with their arrival times, both
+   increasing from oldest to newest, in a fixed-capacity ring. When it
+   is full, the oldest entry is dropped. */
+class InputHistory
+{
+public:
+  using entry_type = std::pair<uint64_t, uint64_t>;
+  static const size_t CAPACITY = 64; /* power of two */
+
+private:
+  std::vector<entry_type> ring; /* allocated on first use */
+  size_t head, count;
+
+public:
+  InputHistory() : ring(), head( 0 ), count( 0 ) {}
+
+  size_t size( void ) const { return count; }
+  const entry_type& at( size_t i ) const { return ring[( head + i ) & ( CAPACITY - 1 )]; }
+
+  void push_back( uint64_t n, uint64_t time )
+  {
+    if ( ring.empty() ) {
+      ring.resize( CAPACITY );
+    }
+    if ( count == CAPACITY ) {
+      pop_front();
+    }
+    ring[( head + count ) & ( CAPACITY - 1 )] = entry_type( n, time );
+    count++;
+  }
+
+  void pop_front( void )
+  {
+    head = ( head + 1 ) & ( CAPACITY - 1 );
+    count--;
+  }
+};
+
+/* A terminal's position in the journal of its framebuffer.  Copies
+   of the live terminal keep the position they were taken at. */
+class JournalMark
+{
+private:
+  std::shared_ptr<Journal> journal;
+  uint64_t seq;
+  bool live;
+
+  uint64_t copy_seq( void ) const { return live ? journal->checkpoint() : seq; }
+
+public:
+  JournalMark() : journal(), seq( 0 ), live( false ) {}
+  JournalMark( const JournalMark& other ) : journal( other.journal ), seq( other.copy_seq() ), live( false ) {}
+  JournalMark& operator=( const JournalMark& other )
+  {
+    journal = other.journal;
+    seq = other.copy_seq();
+    live = false;
+    return *this;
+  }
+
+  void start( Framebuffer& fb )
+  {
+    journal = std::make_shared<Journal>();
+    live = true;
+    fb.set_journal( journal.get() );
+  }
+
+  const Journal* get_journal( void ) const { return journal.get(); }
+  uint64_t get_seq( void ) const { return live ? journal->end_seq() : seq; }
+};
+
 class Complete
 {
 private:
@@ -54,21 +127,37 @@ private:
   // outside calls to act() to keep horrible things from happening.
   Parser::Actions actions;
 
-  using input_history_type = std::list<std::pair<uint64_t, uint64_t>>;
-  input_history_type input_history;
+  InputHistory input_history;
   uint64_t echo_ack;
 
+  bool screen_delta; /* peer understands HostBuffers::ScreenDelta */
+  bool digest;       /* peer verifies HostBuffers::Digest */
+  JournalMark journal_mark;
+
   static const int ECHO_TIMEOUT = 50; /* for late ack */
 
+  void parse( const std::string& str );
+  std::string diff_from( const Complete& existing, bool full ) const;
+
 public:
   Complete( size_t width, size_t height )
-    : parser(), terminal( width, height ), display( false ), actions(), input_history(), echo_ack( 0 )
+    : parser(), terminal( width, height ), display( false ), actions(), input_history(), echo_ack( 0 ),
+      screen_delta( false ), digest( false ), journal_mark()
   {}
 
   std::string act( const std::string& str );
   std::string act( const Parser::Action& act );
+  void act_keystrokes( const std::string& keys, std::string& terminal_to_host )
+  {
+    terminal.user_input( keys, terminal_to_host );
+  }
 
   const Framebuffer& get_fb( void ) const { return terminal.get_fb(); }
+  void set_display_threads( int threads ) { display.set_threads( threads ); }
+  void set_screen_delta( bool s_screen_delta ) { screen_delta = s_screen_delta; }
+  void set_digest( bool s_digest ) { digest = s_digest; }
+  /* Record row movement, so that screen deltas from copies of this terminal are cheaper to find. */
+  void enable_journal( void ) { journal_mark.start( terminal.get_mutable_fb() ); }
   void reset_input( void ) { parser.reset_input(); }
   uint64_t get_echo_ack( void ) const { return echo_ack; }
   bool set_echo_ack( uint64_t now );
@@ -77,10 +166,17 @@ public:
 
   /* interface for Network::Transport */
   void subtract( const Complete* ) const {}
-  std::string diff_from( const Complete& existing ) const;
+  std::string diff_from( const Complete& existing ) const { return diff_from( existing, false ); }
   std::string init_diff( void ) const;
-  void apply_string( const std::string& diff );
+  std::string resync_diff( const Complete& existing ) const { return diff_from( existing, true ); }
+  /* false if the result does not match the digest sent with the diff */
+  bool apply_string( const std::string& diff );
   bool operator==( const Complete& x ) const;
+  /* approximate heap memory held, mostly framebuffer rows, leaving out what is shared with other */
+  size_t memory( const Complete* other ) const
+  {
+    return terminal.get_fb().memory( other ? &other->terminal.get_fb() : NULL );
+  }
 
   bool compare( const Complete& other ) const;
 };
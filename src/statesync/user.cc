@@ -31,7 +31,6 @@
 */
 
 #include <cassert>
-#include <typeinfo>
 
 #include "src/protobufs/userinput.pb.h"
 #include "src/statesync/user.h"
@@ -43,91 +42,93 @@ using namespace ClientBuffers;
 
 void UserStream::subtract( const UserStream* prefix )
 {
-  // if we are subtracting ourself from ourself, just clear the std::deque
-  if ( this == prefix ) {
-    actions.clear();
-    return;
+  const uint64_t new_byte_base = prefix->byte_end();
+  const uint64_t new_resize_base = prefix->resize_end();
+
+  if ( new_byte_base > byte_base ) {
+    assert( new_byte_base <= byte_end() );
+    start += new_byte_base - byte_base;
+    byte_base = new_byte_base;
+
+    /* reclaim the subtracted bytes once they are at least half the log */
+    if ( start >= bytes.size() / 2 ) {
+      bytes.erase( 0, start );
+      start = 0;
+    }
   }
-  for ( std::deque<UserEvent>::const_iterator i = prefix->actions.begin(); i != prefix->actions.end(); i++ ) {
-    assert( this != prefix );
-    assert( !actions.empty() );
-    assert( *i == actions.front() );
-    actions.pop_front();
+
+  if ( new_resize_base > resize_base ) {
+    assert( new_resize_base <= resize_end() );
+    resizes.erase( resizes.begin(), resizes.begin() + ( new_resize_base - resize_base ) );
+    resize_base = new_resize_base;
   }
 }
 
-std::string UserStream::diff_from( const UserStream& existing ) const
+std::string UserStream::diff_from_offsets( uint64_t from_byte, uint64_t from_resize ) const
 {
-  std::deque<UserEvent>::const_iterator my_it = actions.begin();
-
-  for ( std::deque<UserEvent>::const_iterator i = existing.actions.begin(); i != existing.actions.end(); i++ ) {
-    assert( my_it != actions.end() );
-    assert( *i == *my_it );
-    my_it++;
-  }
+  assert( ( byte_base <= from_byte ) && ( from_byte <= byte_end() ) );
+  assert( ( resize_base <= from_resize ) && ( from_resize <= resize_end() ) );
 
   ClientBuffers::UserMessage output;
 
-  while ( my_it != actions.end() ) {
-    switch ( my_it->type ) {
-      case UserByteType: {
-        char the_byte = my_it->userbyte.c;
-        /* can we combine this with a previous Keystroke? */
-        if ( ( output.instruction_size() > 0 )
-             && ( output.instruction( output.instruction_size() - 1 ).HasExtension( keystroke ) ) ) {
-          output.mutable_instruction( output.instruction_size() - 1 )
-            ->MutableExtension( keystroke )
-            ->mutable_keys()
-            ->append( std::string( &the_byte, 1 ) );
-        } else {
-          Instruction* new_inst = output.add_instruction();
-          new_inst->MutableExtension( keystroke )->set_keys( &the_byte, 1 );
-        }
-      } break;
-      case ResizeType: {
-        Instruction* new_inst = output.add_instruction();
-        new_inst->MutableExtension( resize )->set_width( my_it->resize.width );
-        new_inst->MutableExtension( resize )->set_height( my_it->resize.height );
-      } break;
-      default:
-        assert( !"unexpected event type" );
-        break;
+  uint64_t offset = from_byte;
+  for ( std::deque<ResizeMark>::const_iterator i = resizes.begin() + ( from_resize - resize_base );
+        i != resizes.end();
+        i++ ) {
+    if ( i->offset > offset ) {
+      Instruction* new_inst = output.add_instruction();
+      new_inst->MutableExtension( keystroke )->set_keys( bytes.data() + start + ( offset - byte_base ),
+                                                         i->offset - offset );
+      offset = i->offset;
     }
 
-    my_it++;
+    Instruction* new_inst = output.add_instruction();
+    new_inst->MutableExtension( resize )->set_width( i->resize.width );
+    new_inst->MutableExtension( resize )->set_height( i->resize.height );
+  }
+
+  if ( byte_end() > offset ) {
+    Instruction* new_inst = output.add_instruction();
+    new_inst->MutableExtension( keystroke )->set_keys( bytes.data() + start + ( offset - byte_base ),
+                                                       byte_end() - offset );
   }
 
   return output.SerializeAsString();
 }
 
-void UserStream::apply_string( const std::string& diff )
+bool UserStream::apply_string( const std::string& diff )
 {
   ClientBuffers::UserMessage input;
   fatal_assert( input.ParseFromString( diff ) );
 
   for ( int i = 0; i < input.instruction_size(); i++ ) {
     if ( input.instruction( i ).HasExtension( keystroke ) ) {
-      std::string the_bytes = input.instruction( i ).GetExtension( keystroke ).keys();
-      for ( unsigned int loc = 0; loc < the_bytes.size(); loc++ ) {
-        actions.push_back( UserEvent( UserByte( the_bytes.at( loc ) ) ) );
-      }
+      bytes.append( input.instruction( i ).GetExtension( keystroke ).keys() );
     } else if ( input.instruction( i ).HasExtension( resize ) ) {
-      actions.push_back( UserEvent( Resize( input.instruction( i ).GetExtension( resize ).width(),
-                                            input.instruction( i ).GetExtension( resize ).height() ) ) );
+      push_back( Resize( input.instruction( i ).GetExtension( resize ).width(),
+                         input.instruction( i ).GetExtension( resize ).height() ) );
     }
   }
+  return true;
 }
 
-const Parser::Action& UserStream::get_action( unsigned int i ) const
+void UserStream::keystroke_range( size_t i, uint64_t& from, uint64_t& to ) const
 {
-  switch ( actions[i].type ) {
-    case UserByteType:
-      return actions[i].userbyte;
-    case ResizeType:
-      return actions[i].resize;
-    default:
-      assert( !"unexpected action type" );
-      static const Parser::Ignore nothing = Parser::Ignore();
-      return nothing;
-  }
+  assert( i <= resizes.size() );
+  from = ( i == 0 ) ? byte_base : resizes[i - 1].offset;
+  to = ( i == resizes.size() ) ? byte_end() : resizes[i].offset;
+}
+
+std::string UserStream::get_keystrokes( size_t i ) const
+{
+  uint64_t from, to;
+  keystroke_range( i, from, to );
+  return bytes.substr( start + ( from - byte_base ), to - from );
+}
+
+bool UserStream::has_keystrokes( size_t i ) const
+{
+  uint64_t from, to;
+  keystroke_range( i, from, to );
+  return to > from;
 }
@@ -34,61 +34,75 @@
 #define USER_HPP
 
 #include <cassert>
+#include <cstdint>
 #include <deque>
-#include <list>
 #include <string>
 
 #include "src/terminal/parseraction.h"
 
 namespace Network {
-enum UserEventType
+/* The user's input is an append-only log of keystroke bytes, with
+   resizes marked at the byte offset where they happened.  Offsets
+   are absolute from the start of the session, so removing an
+   acknowledged prefix just advances the start of the log, and two
+   states of one stream are equal when they end at the same place. */
+class UserStream
 {
-  UserByteType = 0,
-  ResizeType = 1
-};
+private:
+  class ResizeMark
+  {
+  public:
+    uint64_t offset; /* absolute byte offset of the resize */
+    Parser::Resize resize;
 
-class UserEvent
-{
-public:
-  UserEventType type;
-  Parser::UserByte userbyte;
-  Parser::Resize resize;
+    ResizeMark( uint64_t s_offset, const Parser::Resize& s_resize ) : offset( s_offset ), resize( s_resize ) {}
+  };
 
-  UserEvent( const Parser::UserByte& s_userbyte ) : type( UserByteType ), userbyte( s_userbyte ), resize( -1, -1 )
-  {}
-  UserEvent( const Parser::Resize& s_resize ) : type( ResizeType ), userbyte( 0 ), resize( s_resize ) {}
+  std::string bytes; /* keystrokes; those before start have been subtracted */
+  size_t start;
+  uint64_t byte_base; /* absolute offset of bytes[start] */
 
-private:
-  UserEvent();
+  std::deque<ResizeMark> resizes;
+  uint64_t resize_base; /* number of resizes before resizes.front() */
 
-public:
-  bool operator==( const UserEvent& x ) const
-  {
-    return ( type == x.type ) && ( userbyte == x.userbyte ) && ( resize == x.resize );
-  }
-};
+  uint64_t byte_end( void ) const { return byte_base + ( bytes.size() - start ); }
+  uint64_t resize_end( void ) const { return resize_base + resizes.size(); }
 
-class UserStream
-{
-private:
-  std::deque<UserEvent> actions;
+  std::string diff_from_offsets( uint64_t from_byte, uint64_t from_resize ) const;
+  void keystroke_range( size_t i, uint64_t& from, uint64_t& to ) const;
 
 public:
-  UserStream() : actions() {}
+  UserStream() : bytes(), start( 0 ), byte_base( 0 ), resizes(), resize_base( 0 ) {}
+
+  void push_back( const Parser::UserByte& s_userbyte ) { bytes.push_back( s_userbyte.c ); }
+  void push_back( const Parser::Resize& s_resize ) { resizes.push_back( ResizeMark( byte_end(), s_resize ) ); }
 
-  void push_back( const Parser::UserByte& s_userbyte ) { actions.push_back( UserEvent( s_userbyte ) ); }
-  void push_back( const Parser::Resize& s_resize ) { actions.push_back( UserEvent( s_resize ) ); }
+  bool empty( void ) const { return ( start == bytes.size() ) && resizes.empty(); }
 
-  bool empty( void ) const { return actions.empty(); }
-  size_t size( void ) const { return actions.size(); }
-  const Parser::Action& get_action( unsigned int i ) const;
+  /* The contents in order are get_keystrokes( 0 ), get_resize( 0 ),
+     get_keystrokes( 1 ), ..., get_resize( n - 1 ), get_keystrokes( n )
+     where n = resize_count(). */
+  size_t resize_count( void ) const { return resizes.size(); }
+  const Parser::Resize& get_resize( size_t i ) const { return resizes.at( i ).resize; }
+  std::string get_keystrokes( size_t i ) const;
+  bool has_keystrokes( size_t i ) const;
 
   /* interface for Network::Transport */
   void subtract( const UserStream* prefix );
-  std::string diff_from( const UserStream& existing ) const;
-  std::string init_diff( void ) const { return diff_from( UserStream() ); };
-  void apply_string( const std::string& diff );
-  bool operator==( const UserStream& x ) const { return actions == x.actions; }
+  std::string diff_from( const UserStream& existing ) const
+  {
+    return diff_from_offsets( existing.byte_end(), existing.resize_end() );
+  }
+  std::string init_diff( void ) const { return diff_from_offsets( byte_base, resize_base ); };
+  /* user input carries no digest, so its receiver never asks to resync */
+  std::string resync_diff( const UserStream& existing ) const { return diff_from( existing ); }
+  bool apply_string( const std::string& diff );
+  /* approximate heap memory held; copies share nothing */
+  size_t memory( const UserStream* ) const { return bytes.capacity() + resizes.size() * sizeof( ResizeMark ); }
+  bool operator==( const UserStream& x ) const
+  {
+    return ( byte_end() == x.byte_end() ) && ( resize_end() == x.resize_end() );
+  }
 
   bool compare( const UserStream& ) { return false; }
 };
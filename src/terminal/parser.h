@@ -62,6 +62,7 @@ public:
   void input( wchar_t ch, Actions& actions );
 
   void reset_input( void ) { state = &family.s_Ground; }
+  bool is_ground( void ) const { return state == &family.s_Ground; }
 };
 
 static const size_t BUF_SIZE = 8;
@@ -85,6 +86,9 @@ public:
     buf[0] = '\0';
     buf_len = 0;
   }
+
+  /* no escape sequence or multibyte character in progress */
+  bool is_ground( void ) const { return ( buf_len == 0 ) && parser.is_ground(); }
 };
 }
 
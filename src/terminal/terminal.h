@@ -79,7 +79,14 @@ public:
 
   std::string read_octets_to_host( void );
 
+  /* Translate a run of user keystrokes into octets to host */
+  void user_input( const std::string& keys, std::string& terminal_to_host )
+  {
+    user.input( keys, fb.ds.application_mode_cursor_keys, terminal_to_host );
+  }
+
   const Framebuffer& get_fb( void ) const { return fb; }
+  Framebuffer& get_mutable_fb( void ) { return fb; } /* for structured screen deltas */
 
   bool operator==( Emulator const& x ) const;
 };
@@ -30,7 +30,11 @@
     also delete it here.
 */
 
+#include <algorithm>
 #include <cstdio>
+#include <exception>
+#include <thread>
+#include <vector>
 
 #include "src/terminal/terminalframebuffer.h"
 #include "terminaldisplay.h"
@@ -58,6 +62,14 @@ std::string Display::close() const
          + std::string( rmcup ? rmcup : "" );
 }
 
+std::string Display::synchronized( const std::string& frame ) const
+{
+  if ( !has_sync || frame.empty() ) {
+    return frame;
+  }
+  return "\033[?2026h" + frame + "\033[?2026l";
+}
+
 std::string Display::new_frame( bool initialized, const Framebuffer& last, const Framebuffer& f ) const
 {
   FrameState frame( last );
@@ -247,9 +259,14 @@ std::string Display::new_frame( bool initialized, const Framebuffer& last, const
   }
 
   /* Now update the display, row by row */
-  bool wrap = false;
-  for ( ; frame_y < f.ds.get_height(); frame_y++ ) {
-    wrap = put_row( initialized, frame, f, frame_y, *rows.at( frame_y ), wrap );
+  if ( threads > 1 && f.ds.get_width() * ( f.ds.get_height() - frame_y ) >= PARALLEL_MIN_CELLS
+       && f.ds.get_height() - frame_y >= 2 * PARALLEL_MIN_ROWS_PER_THREAD ) {
+    put_rows_parallel( initialized, frame, f, frame_y, rows );
+  } else {
+    bool wrap = false;
+    for ( ; frame_y < f.ds.get_height(); frame_y++ ) {
+      wrap = put_row( initialized, frame, f, frame_y, *rows.at( frame_y ), wrap );
+    }
   }
 
   /* has cursor location changed? */
@@ -458,6 +475,117 @@ bool Display::put_row( bool initialized,
   return false;
 }
 
+/* The output of put_row() for one row, drawn speculatively from a guessed
+   starting cursor, rendition and wrap state. */
+class RowFragment
+{
+public:
+  bool valid;
+  int start_x, start_y, end_x, end_y;
+  Renditions start_rendition, end_rendition;
+  bool start_visible, end_visible;
+  bool start_wrap, end_wrap;
+  std::string str;
+
+  RowFragment()
+    : valid( false ), start_x( 0 ), start_y( 0 ), end_x( 0 ), end_y( 0 ), start_rendition( 0 ), end_rendition( 0 ),
+      start_visible( false ), end_visible( false ), start_wrap( false ), end_wrap( false ), str()
+  {}
+
+  bool starts_at( const FrameState& frame, bool wrap ) const
+  {
+    return valid && start_x == frame.cursor_x && start_y == frame.cursor_y
+           && start_rendition == frame.current_rendition && start_visible == frame.cursor_visible
+           && start_wrap == wrap;
+  }
+};
+
+/* Draw rows in contiguous blocks on several threads, then stitch the
+   fragments together in order.  Every block but the first starts from a
+   guess (cursor at the start of the row, rendition of the previous row's
+   last cell); wherever a fragment's starting state doesn't match what the
+   serial draw would have had, that row is redrawn serially.  put_row() is
+   deterministic, so the result is byte-identical to the serial path. */
+void Display::put_rows_parallel( bool initialized,
+                                 FrameState& frame,
+                                 const Framebuffer& f,
+                                 int frame_y,
+                                 const Framebuffer::rows_type& old_rows ) const
+{
+  const int height = f.ds.get_height();
+  const int num_rows = height - frame_y;
+  int num_blocks = std::min( threads, num_rows / PARALLEL_MIN_ROWS_PER_THREAD );
+  std::vector<RowFragment> fragments( num_rows );
+
+  auto draw_block = [&]( int first, int last ) {
+    try {
+      FrameState block( frame.last_frame );
+      if ( first == frame_y ) {
+        block.cursor_x = frame.cursor_x;
+        block.cursor_y = frame.cursor_y;
+        block.current_rendition = frame.current_rendition;
+        block.cursor_visible = frame.cursor_visible;
+      } else {
+        block.cursor_x = 0;
+        block.cursor_y = first;
+        block.current_rendition = f.get_row( first - 1 )->cells.back().get_renditions();
+        block.cursor_visible = false;
+      }
+      bool wrap = false;
+      for ( int y = first; y < last; y++ ) {
+        RowFragment& frag = fragments.at( y - frame_y );
+        frag.start_x = block.cursor_x;
+        frag.start_y = block.cursor_y;
+        frag.start_rendition = block.current_rendition;
+        frag.start_visible = block.cursor_visible;
+        frag.start_wrap = wrap;
+        block.str.clear();
+        wrap = put_row( initialized, block, f, y, *old_rows.at( y ), wrap );
+        frag.str = block.str;
+        frag.end_x = block.cursor_x;
+        frag.end_y = block.cursor_y;
+        frag.end_rendition = block.current_rendition;
+        frag.end_visible = block.cursor_visible;
+        frag.end_wrap = wrap;
+        frag.valid = true;
+      }
+    } catch ( const std::exception& ) {
+      /* leave remaining fragments invalid; they will be drawn serially */
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for ( int i = 1; i < num_blocks; i++ ) {
+    const int first = frame_y + num_rows * i / num_blocks;
+    const int last = frame_y + num_rows * ( i + 1 ) / num_blocks;
+    try {
+      workers.push_back( std::thread( draw_block, first, last ) );
+    } catch ( const std::exception& ) {
+      /* couldn't start thread; these rows will be drawn serially */
+    }
+  }
+  draw_block( frame_y, frame_y + num_rows / num_blocks );
+  for ( std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); i++ ) {
+    i->join();
+  }
+
+  /* stitch */
+  bool wrap = false;
+  for ( int y = frame_y; y < height; y++ ) {
+    const RowFragment& frag = fragments.at( y - frame_y );
+    if ( frag.starts_at( frame, wrap ) ) {
+      frame.append_string( frag.str );
+      frame.cursor_x = frag.end_x;
+      frame.cursor_y = frag.end_y;
+      frame.current_rendition = frag.end_rendition;
+      frame.cursor_visible = frag.end_visible;
+      wrap = frag.end_wrap;
+    } else {
+      wrap = put_row( initialized, frame, f, y, *old_rows.at( y ), wrap );
+    }
+  }
+}
+
 FrameState::FrameState( const Framebuffer& s_last )
   : str(), cursor_x( 0 ), cursor_y( 0 ), current_rendition( 0 ), cursor_visible( s_last.ds.cursor_visible ),
     last_frame( s_last )
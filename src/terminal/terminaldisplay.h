@@ -74,6 +74,14 @@ private:
 
   const char *smcup, *rmcup; /* enter and exit alternate screen mode */
 
+  bool has_sync; /* supports synchronized output (DEC private mode 2026) */
+
+  int threads; /* number of threads to split the rows of large frames across */
+
+  /* frames smaller than this are always drawn serially */
+  static const int PARALLEL_MIN_CELLS = 32768;
+  static const int PARALLEL_MIN_ROWS_PER_THREAD = 8;
+
   bool put_row( bool initialized,
                 FrameState& frame,
                 const Framebuffer& f,
@@ -81,12 +89,27 @@ private:
                 const Row& old_row,
                 bool wrap ) const;
 
+  void put_rows_parallel( bool initialized,
+                          FrameState& frame,
+                          const Framebuffer& f,
+                          int frame_y,
+                          const Framebuffer::rows_type& old_rows ) const;
+
 public:
   std::string open() const;
   std::string close() const;
 
   std::string new_frame( bool initialized, const Framebuffer& last, const Framebuffer& f ) const;
 
+  /* wrap a frame so the terminal draws it all at once, if it can */
+  std::string synchronized( const std::string& frame ) const;
+
+  void set_sync( bool s_has_sync ) { has_sync = s_has_sync; }
+  bool get_sync( void ) const { return has_sync; }
+
+  void set_threads( int s_threads ) { threads = s_threads; }
+  int get_threads( void ) const { return threads; }
+
   Display( bool use_environment );
 };
 }
@@ -81,7 +81,8 @@ static const char* ti_str( const char* capname )
 }
 
 Display::Display( bool use_environment )
-  : has_ech( true ), has_bce( true ), has_title( true ), smcup( NULL ), rmcup( NULL )
+  : has_ech( true ), has_bce( true ), has_title( true ), smcup( NULL ), rmcup( NULL ), has_sync( false ),
+    threads( 1 )
 {
   if ( use_environment ) {
     int errret = -2;
@@ -131,5 +132,15 @@ Display::Display( bool use_environment )
       smcup = ti_str( "smcup" );
       rmcup = ti_str( "rmcup" );
     }
+
+    /* check for synchronized output ("Sync" is an extended capability,
+       so it's fine for it to be unknown) */
+    const char* sync = tigetstr( const_cast<char*>( "Sync" ) );
+    has_sync = sync && sync != (const char*)-1;
+
+    const char* display_threads = getenv( "MOSH_DISPLAY_THREADS" );
+    if ( display_threads ) {
+      threads = atoi( display_threads );
+    }
   }
 }
@@ -30,6 +30,7 @@
     also delete it here.
 */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -65,15 +66,15 @@ DrawState::DrawState( int s_width, int s_height )
     scrolling_region_bottom_row( height - 1 ), renditions( 0 ), save(), next_print_will_wrap( false ),
     origin_mode( false ), auto_wrap_mode( true ), insert_mode( false ), cursor_visible( true ),
     reverse_video( false ), bracketed_paste( false ), mouse_reporting_mode( MOUSE_REPORTING_NONE ),
-    mouse_focus_event( false ), mouse_alternate_scroll( false ), mouse_encoding_mode( MOUSE_ENCODING_DEFAULT ),
-    application_mode_cursor_keys( false )
+    mouse_focus_event( false ), mouse_alternate_scroll( false ), synchronized_output( false ),
+    mouse_encoding_mode( MOUSE_ENCODING_DEFAULT ), application_mode_cursor_keys( false )
 {
   reinitialize_tabs( 0 );
 }
 
 Framebuffer::Framebuffer( int s_width, int s_height )
   : rows(), icon_name(), window_title(), clipboard(), bell_count( 0 ), title_initialized( false ),
-    ds( s_width, s_height )
+    journal( NULL ), ds( s_width, s_height )
 {
   assert( s_height > 0 );
   assert( s_width > 0 );
@@ -85,7 +86,7 @@ Framebuffer::Framebuffer( int s_width, int s_height )
 Framebuffer::Framebuffer( const Framebuffer& other )
   : rows( other.rows ), icon_name( other.icon_name ), window_title( other.window_title ),
     clipboard( other.clipboard ), bell_count( other.bell_count ), title_initialized( other.title_initialized ),
-    ds( other.ds )
+    journal( NULL ), ds( other.ds )
 {}
 
 Framebuffer& Framebuffer::operator=( const Framebuffer& other )
@@ -102,6 +103,28 @@ Framebuffer& Framebuffer::operator=( const Framebuffer& other )
   return *this;
 }
 
+size_t Framebuffer::memory( const Framebuffer* other ) const
+{
+  /* shared rows may have moved, as they do when the screen scrolls */
+  std::vector<const Row*> shared;
+  if ( other ) {
+    shared.reserve( other->rows.size() );
+    for ( const row_pointer& r : other->rows ) {
+      shared.push_back( r.get() );
+    }
+    std::sort( shared.begin(), shared.end() );
+  }
+
+  size_t bytes = rows.capacity() * sizeof( row_pointer )
+                 + ( icon_name.capacity() + window_title.capacity() + clipboard.capacity() ) * sizeof( wchar_t );
+  for ( const row_pointer& r : rows ) {
+    if ( !std::binary_search( shared.begin(), shared.end(), r.get() ) ) {
+      bytes += sizeof( Row ) + r->cells.capacity() * sizeof( Cell );
+    }
+  }
+  return bytes;
+}
+
 void Framebuffer::scroll( int N )
 {
   if ( N >= 0 ) {
@@ -309,6 +332,10 @@ void Framebuffer::insert_line( int before_row, int count )
     return;
   }
 
+  if ( journal ) {
+    journal->shift( before_row, ds.get_scrolling_region_bottom_row(), -scroll );
+  }
+
   // delete old rows
   rows_type::iterator start = rows.begin() + ds.get_scrolling_region_bottom_row() + 1 - scroll;
   rows.erase( start, start + scroll );
@@ -332,6 +359,10 @@ void Framebuffer::delete_line( int row, int count )
     return;
   }
 
+  if ( journal ) {
+    journal->shift( row, ds.get_scrolling_region_bottom_row(), scroll );
+  }
+
   // delete old rows
   rows_type::iterator start = rows.begin() + row;
   rows.erase( start, start + scroll );
@@ -341,9 +372,51 @@ void Framebuffer::delete_line( int row, int count )
 }
 
 Row::Row( const size_t s_width, const color_type background_color )
-  : cells( s_width, Cell( background_color ) ), gen( get_gen() )
+  : cells( s_width, Cell( background_color ) ), gen( get_gen() ), digest_value( 0 ), digest_valid( false )
 {}
 
+/* Not cryptographic: only meant to catch a client's framebuffer
+   drifting from the server's. */
+static uint64_t digest_mix( uint64_t h, uint64_t v )
+{
+  h = ( h ^ v ) * 0x9e3779b97f4a7c15ULL;
+  return h ^ ( h >> 29 );
+}
+
+template<class T>
+static uint64_t digest_mix_all( uint64_t h, const T& s )
+{
+  h = digest_mix( h, s.size() );
+  for ( typename T::const_iterator i = s.begin(); i != s.end(); i++ ) {
+    h = digest_mix( h, static_cast<uint64_t>( *i ) );
+  }
+  return h;
+}
+
+uint64_t Row::digest( void ) const
+{
+  if ( !digest_valid ) {
+    /* cells are hashed independently (so the work can overlap) along with their column */
+    uint64_t h = cells.size();
+    uint64_t col = 0;
+    for ( cells_type::const_iterator i = cells.begin(); i != cells.end(); i++, col++ ) {
+      /* FNV-1a of the contents, usually a single byte */
+      const std::string& contents = i->get_contents();
+      uint64_t word = 0xcbf29ce484222325ULL;
+      for ( std::string::const_iterator c = contents.begin(); c != contents.end(); c++ ) {
+        word = ( word ^ static_cast<unsigned char>( *c ) ) * 0x100000001b3ULL;
+      }
+      /* renditions use the low 58 bits */
+      const uint64_t look = i->get_renditions().pack() ^ ( uint64_t( i->get_wide() ) << 61 )
+                            ^ ( uint64_t( i->get_fallback() ) << 62 ) ^ ( uint64_t( i->get_wrap() ) << 63 );
+      h += digest_mix( digest_mix( col, word ), look );
+    }
+    digest_value = h;
+    digest_valid = true;
+  }
+  return digest_value;
+}
+
 uint64_t Row::get_gen() const
 {
   static uint64_t gen_counter = 0;
@@ -377,6 +450,9 @@ void Framebuffer::reset( void )
   int width = ds.get_width(), height = ds.get_height();
   ds = DrawState( width, height );
   rows = rows_type( height, newrow() );
+  if ( journal ) {
+    journal->reset();
+  }
   window_title.clear();
   clipboard.clear();
   /* do not reset bell_count */
@@ -401,6 +477,9 @@ void Framebuffer::resize( int s_width, int s_height )
   int oldheight = ds.get_height();
   int oldwidth = ds.get_width();
   ds.resize( s_width, s_height );
+  if ( journal ) {
+    journal->reset();
+  }
 
   row_pointer blankrow( newrow() );
   if ( oldheight != s_height ) {
@@ -411,6 +490,7 @@ void Framebuffer::resize( int s_width, int s_height )
   }
   for ( rows_type::iterator i = rows.begin(); i != rows.end() && *i != blankrow; i++ ) {
     *i = std::make_shared<Row>( **i );
+    ( *i )->invalidate_digest();
     ( *i )->set_wrap( false );
     ( *i )->cells.resize( s_width, Cell( ds.get_background_rendition() ) );
   }
@@ -602,6 +682,71 @@ void Row::reset( color_type background_color )
   }
 }
 
+void Journal::shift( int top, int bottom, int count )
+{
+  /* successive scrolls of one region in one direction add up */
+  if ( ( end_seq() > barrier ) && ( shifts.back().top == top ) && ( shifts.back().bottom == bottom )
+       && ( ( shifts.back().count > 0 && count > 0 ) || ( shifts.back().count < 0 && count < 0 ) ) ) {
+    const int limit = bottom - top + 1;
+    int merged = shifts.back().count + count;
+    merged = std::max( -limit, std::min( limit, merged ) );
+    shifts.back().count = merged;
+    return;
+  }
+  record( Shift( top, bottom, count ) );
+}
+
+bool Journal::origins( uint64_t from, uint64_t to, int height, std::vector<int>& origin ) const
+{
+  if ( ( from < first_seq ) || ( from > to ) || ( to > end_seq() ) ) {
+    return false;
+  }
+
+  origin.resize( height );
+  for ( int y = 0; y < height; y++ ) {
+    origin[y] = y;
+  }
+
+  const std::deque<Shift>::const_iterator end = shifts.begin() + ( to - first_seq );
+  for ( std::deque<Shift>::const_iterator i = shifts.begin() + ( from - first_seq ); i != end; i++ ) {
+    if ( ( i->count == 0 ) || ( i->top < 0 ) || ( i->bottom >= height ) ) {
+      return false;
+    }
+    if ( i->count > 0 ) {
+      for ( int y = i->top; y <= i->bottom; y++ ) {
+        origin[y] = ( y + i->count <= i->bottom ) ? origin[y + i->count] : -1;
+      }
+    } else {
+      for ( int y = i->bottom; y >= i->top; y-- ) {
+        origin[y] = ( y + i->count >= i->top ) ? origin[y + i->count] : -1;
+      }
+    }
+  }
+
+  return true;
+}
+
+uint64_t Framebuffer::digest( void ) const
+{
+  uint64_t h = digest_mix( ds.get_width(), ds.get_height() );
+  for ( rows_type::const_iterator i = rows.begin(); i != rows.end(); i++ ) {
+    h = digest_mix( h, ( *i )->digest() );
+  }
+
+  h = digest_mix( h, ds.get_cursor_row() );
+  h = digest_mix( h, ds.get_cursor_col() );
+  h = digest_mix( h, ds.get_renditions().pack() );
+  h = digest_mix( h,
+                  ds.cursor_visible | ( ds.reverse_video << 1 ) | ( ds.bracketed_paste << 2 )
+                    | ( ds.mouse_focus_event << 3 ) | ( ds.mouse_alternate_scroll << 4 ) );
+  h = digest_mix( h, ds.mouse_reporting_mode );
+  h = digest_mix( h, ds.mouse_encoding_mode );
+
+  h = digest_mix_all( h, icon_name );
+  h = digest_mix_all( h, window_title );
+  return digest_mix_all( h, clipboard );
+}
+
 void Framebuffer::prefix_window_title( const title_type& s )
 {
   if ( icon_name == window_title ) {
@@ -96,6 +96,20 @@ public:
   }
   bool get_attribute( attribute_type attr ) const { return attributes & ( 1 << attr ); }
   void clear_attributes() { attributes = 0; }
+
+  /* lossless packing into one integer, for the structured screen delta */
+  uint64_t pack( void ) const
+  {
+    return foreground_color | ( uint64_t( background_color ) << 25 ) | ( uint64_t( attributes ) << 50 );
+  }
+  static Renditions unpack( uint64_t x )
+  {
+    Renditions r( 0 );
+    r.foreground_color = x & 0x1ffffff;
+    r.background_color = ( x >> 25 ) & 0x1ffffff;
+    r.attributes = ( x >> 50 ) & 0xff;
+    return r;
+  }
 };
 
 class Cell
@@ -127,6 +141,9 @@ public:
   /* Accessors for contents field */
   std::string debug_contents( void ) const;
 
+  const content_type& get_contents( void ) const { return contents; }
+  void set_contents( const char* s, size_t len ) { contents.assign( s, s + len ); }
+
   bool empty( void ) const { return contents.empty(); }
   /* 32 seems like a reasonable limit on combining characters */
   bool full( void ) const { return contents.size() >= 32; }
@@ -221,11 +238,18 @@ public:
   uint64_t gen;
 
 private:
+  /* cached digest of the cells, until the row is next made mutable */
+  mutable uint64_t digest_value;
+  mutable bool digest_valid;
+
   Row();
 
 public:
   Row( const size_t s_width, const color_type background_color );
 
+  uint64_t digest( void ) const;
+  void invalidate_digest( void ) { digest_valid = false; }
+
   void insert_cell( int col, color_type background_color );
   void delete_cell( int col, color_type background_color );
 
@@ -295,6 +319,7 @@ public:
 
   bool mouse_focus_event;      // 1004
   bool mouse_alternate_scroll; // 1007
+  bool synchronized_output;    // 2026; doesn't affect display
 
   enum MouseEncodingMode
   {
@@ -359,6 +384,54 @@ public:
   }
 };
 
+/* A bounded record of how the rows of a framebuffer have moved, so
+   that rows can be matched with those of an earlier frame without
+   searching for them.  Points in the record are sequence numbers. */
+class Journal
+{
+public:
+  static const size_t CAPACITY = 1024;
+
+private:
+  /* Rows top..bottom move up by count (down if negative), and the
+     vacated rows are new.  A count of zero means anything may have
+     happened. */
+  class Shift
+  {
+  public:
+    int top, bottom, count;
+
+    Shift( int s_top, int s_bottom, int s_count ) : top( s_top ), bottom( s_bottom ), count( s_count ) {}
+  };
+
+  std::deque<Shift> shifts;
+  uint64_t first_seq; /* sequence number of shifts.front() */
+  uint64_t barrier;   /* latest checkpoint; shifts are not merged across it */
+
+  void record( const Shift& shift )
+  {
+    shifts.push_back( shift );
+    if ( shifts.size() > CAPACITY ) {
+      shifts.pop_front();
+      first_seq++;
+    }
+  }
+
+public:
+  Journal() : shifts(), first_seq( 0 ), barrier( 0 ) {}
+
+  uint64_t end_seq( void ) const { return first_seq + shifts.size(); }
+  uint64_t checkpoint( void ) { return barrier = end_seq(); }
+
+  void shift( int top, int bottom, int count );
+  void reset( void ) { record( Shift( 0, 0, 0 ) ); }
+
+  /* Finds, for each row, the row it was at the earlier point (-1 if it
+     is new since).  Fails if the shifts between the points are no
+     longer all recorded, or include a reset. */
+  bool origins( uint64_t from, uint64_t to, int height, std::vector<int>& origin ) const;
+};
+
 class Framebuffer
 {
   // To minimize copying of rows and cells, we use shared_ptr to
@@ -385,6 +458,7 @@ private:
   title_type clipboard;
   unsigned int bell_count;
   bool title_initialized; /* true if the window title has been set via an OSC */
+  Journal* journal;       /* not copied */
 
   row_pointer newrow( void )
   {
@@ -400,6 +474,10 @@ public:
   DrawState ds;
 
   const rows_type& get_rows() const { return rows; }
+  /* approximate heap memory held, leaving out rows shared with other, if any */
+  size_t memory( const Framebuffer* other ) const;
+
+  void set_journal( Journal* s_journal ) { journal = s_journal; }
 
   void scroll( int N );
   void move_rows_autoscroll( int rows );
@@ -422,6 +500,9 @@ public:
     return &rows.at( row )->cells.at( col );
   }
 
+  /* share a row (typically one of another frame's) in place of this one's */
+  void set_row( int row, const row_pointer& r ) { rows.at( row ) = r; }
+
   Row* get_mutable_row( int row )
   {
     if ( row == -1 )
@@ -431,6 +512,7 @@ public:
     if ( !mutable_row.unique() ) {
       mutable_row = std::make_shared<Row>( *mutable_row );
     }
+    mutable_row->invalidate_digest();
     return mutable_row.get();
   }
 
@@ -476,6 +558,9 @@ public:
   void ring_bell( void ) { bell_count++; }
   unsigned int get_bell_count( void ) const { return bell_count; }
 
+  /* Hash of everything a client displays (not the bell, which is an event). */
+  uint64_t digest( void ) const;
+
   bool operator==( const Framebuffer& x ) const
   {
     return ( rows == x.rows ) && ( window_title == x.window_title ) && ( clipboard == x.clipboard )
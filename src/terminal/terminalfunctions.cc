@@ -304,6 +304,8 @@ static bool* get_DEC_mode( int param, Framebuffer* fb )
       return &( fb->ds.mouse_alternate_scroll );
     case 2004: /* bracketed paste */
       return &( fb->ds.bracketed_paste );
+    case 2026: /* synchronized output */
+      return &( fb->ds.synchronized_output );
     default:
       break;
   }
@@ -352,6 +354,17 @@ static void CSI_DECRM( Framebuffer* fb, Dispatcher* dispatch )
 static Function func_CSI_DECSM( CSI, "?h", CSI_DECSM, false );
 static Function func_CSI_DECRM( CSI, "?l", CSI_DECRM, false );
 
+/* request private mode -- only answered for synchronized output,
+   which applications probe for before using it */
+static void CSI_DECRQM( Framebuffer* fb, Dispatcher* dispatch )
+{
+  if ( dispatch->getparam( 0, 0 ) == 2026 ) {
+    dispatch->terminal_to_host.append( fb->ds.synchronized_output ? "\033[?2026;1$y" : "\033[?2026;2$y" );
+  }
+}
+
+static Function func_CSI_DECRQM( CSI, "?$p", CSI_DECRQM, false );
+
 static bool* get_ANSI_mode( int param, Framebuffer* fb )
 {
   if ( param == 4 ) { /* insert/replace mode */
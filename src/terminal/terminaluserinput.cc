@@ -79,3 +79,26 @@ std::string UserInput::input( const Parser::UserByte* act, bool application_mode
       return std::string();
   }
 }
+
+/* Translate a run of keystrokes, appending them to output. Everything
+   up to an ESC passes through unchanged, so copy it in one piece. */
+void UserInput::input( const std::string& keys, bool application_mode_cursor_keys, std::string& output )
+{
+  size_t i = 0;
+  while ( i < keys.size() ) {
+    if ( state == Ground ) {
+      size_t esc = keys.find( '\033', i );
+      if ( esc == std::string::npos ) {
+        output.append( keys, i, std::string::npos );
+        return;
+      }
+      output.append( keys, i, esc + 1 - i );
+      state = ESC;
+      i = esc + 1;
+      continue;
+    }
+
+    Parser::UserByte byte( keys[i++] );
+    output.append( input( &byte, application_mode_cursor_keys ) );
+  }
+}
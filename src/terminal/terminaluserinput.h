@@ -54,6 +54,7 @@ public:
   UserInput() : state( Ground ) {}
 
   std::string input( const Parser::UserByte* act, bool application_mode_cursor_keys );
+  void input( const std::string& keys, bool application_mode_cursor_keys, std::string& output );
 
   bool operator==( const UserInput& x ) const { return state == x.state; }
 };
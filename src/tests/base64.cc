@@ -40,6 +40,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 
 #include "base64_vector.h"
 #include "src/crypto/base64.h"
@@ -103,6 +104,23 @@ static void test_base64( void )
     printf( "random PASSED\n" );
   }
 
+  /* and 256-bit keys for the other ciphers, named in the key */
+  for ( int a = AES_256_GCM; a <= CHACHA20_POLY1305; a++ ) {
+    const Algorithm algorithm = Algorithm( a );
+    if ( algorithm_from_name( algorithm_name( algorithm ) ) == ALGORITHM_NONE ) {
+      continue; /* not in this build */
+    }
+    for ( int i = 0; i < ( 1 << 14 ); i++ ) {
+      Base64Key key1( prng, algorithm );
+      Base64Key key2( key1.printable_key() );
+      fatal_assert( key2.get_algorithm() == algorithm && key1.printable_key() == key2.printable_key()
+                    && !memcmp( key1.data(), key2.data(), 32 ) );
+    }
+  }
+  if ( verbose ) {
+    printf( "random-256 PASSED\n" );
+  }
+
   /* test bad keys */
   const char* bad_keys[] = {
     "",
@@ -128,6 +146,29 @@ static void test_base64( void )
   if ( verbose ) {
     printf( "bad-keys PASSED\n" );
   }
+
+  /* test bad printable keys, naming ciphers or not */
+  const std::string bad_printable_keys[] = {
+    "aes-128-ocb:AAAAAAAAAAAAAAAAAAAAAA",
+    "rot13:" + std::string( 43, 'A' ),
+    "aes-256-gcm:AAAAAAAAAAAAAAAAAAAAAA",
+    "aes-256-gcm:" + std::string( 42, 'A' ) + "B",
+    "chacha20-poly1305:" + std::string( 44, 'A' ),
+    ":" + std::string( 43, 'A' ),
+    std::string( 43, 'A' ),
+  };
+  for ( const std::string& printable_key : bad_printable_keys ) {
+    bool got_exn = false;
+    try {
+      Base64Key key( printable_key );
+    } catch ( const CryptoException& e ) {
+      got_exn = true;
+    }
+    fatal_assert( got_exn );
+  }
+  if ( verbose ) {
+    printf( "bad-printable-keys PASSED\n" );
+  }
 }
 
 int main( int argc, char* argv[] )
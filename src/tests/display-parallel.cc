@@ -0,0 +1,130 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+/* Tests that drawing frames with the rows split across several threads
+   produces exactly the same output as drawing them serially. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "src/statesync/completeterminal.h"
+#include "src/terminal/terminaldisplay.h"
+#include "src/util/fatal_assert.h"
+
+using namespace Terminal;
+
+static const int THREADS = 4;
+
+/* Random text, colors, cursor motion, scrolling and erasure. */
+static std::string random_output( int width, int height, size_t len )
+{
+  std::string ret;
+  char tmp[64];
+  while ( ret.size() < len ) {
+    switch ( rand() % 16 ) {
+      case 0:
+        snprintf( tmp, sizeof tmp, "\033[%d;%dm", 30 + rand() % 8, 40 + rand() % 8 );
+        ret += tmp;
+        break;
+      case 1:
+        ret += "\033[0m";
+        break;
+      case 2:
+        snprintf( tmp, sizeof tmp, "\033[%d;%dH", 1 + rand() % height, 1 + rand() % width );
+        ret += tmp;
+        break;
+      case 3:
+        ret += "\r\n";
+        break;
+      case 4:
+        ret += ( rand() % 2 ) ? "\033[K" : "\033[1K";
+        break;
+      case 5:
+        ret.append( rand() % 40, ' ' );
+        break;
+      default:
+        for ( int i = rand() % 80; i > 0; i-- ) {
+          ret += static_cast<char>( ' ' + rand() % 95 );
+        }
+        break;
+    }
+  }
+  return ret;
+}
+
+static void check_frame( bool initialized, const Framebuffer& last, const Framebuffer& f )
+{
+  Display serial( false );
+  Display parallel( false );
+  parallel.set_threads( THREADS );
+
+  fatal_assert( serial.new_frame( initialized, last, f ) == parallel.new_frame( initialized, last, f ) );
+}
+
+static void test_size( int width, int height )
+{
+  Complete terminal( width, height );
+  Framebuffer blank( width, height );
+
+  for ( int i = 0; i < 20; i++ ) {
+    Framebuffer last( terminal.get_fb() );
+    terminal.act( random_output( width, height, rand() % ( width * height ) ) );
+    check_frame( false, blank, terminal.get_fb() );
+    check_frame( true, last, terminal.get_fb() );
+
+    /* scroll part of the screen */
+    last = terminal.get_fb();
+    char tmp[64];
+    snprintf( tmp, sizeof tmp, "\033[%d;1H", height );
+    terminal.act( std::string( tmp ) + random_output( width, height, width * 4 ) );
+    check_frame( true, last, terminal.get_fb() );
+  }
+
+  /* resize */
+  Framebuffer last( terminal.get_fb() );
+  terminal.act( Parser::Resize( width + 17, height + 9 ) );
+  terminal.act( random_output( width + 17, height + 9, width * 8 ) );
+  check_frame( true, last, terminal.get_fb() );
+}
+
+int main()
+{
+  srand( 1 );
+
+  test_size( 80, 24 ); /* below the parallel threshold */
+  test_size( 300, 120 );
+  test_size( 500, 150 );
+
+  return 0;
+}
@@ -88,16 +88,16 @@ static void test_bad_decrypt( Session& decryption_session )
 }
 
 /* Generate a single key and initial nonce, then perform some encryptions. */
-static void test_one_session( void )
+static void test_one_session( Algorithm algorithm )
 {
-  Base64Key key;
+  Base64Key key( algorithm );
   Session encryption_session( key );
-  Session decryption_session( key );
+  Session decryption_session( Base64Key( key.printable_key() ) );
 
   uint64_t nonce_int = prng.uint64();
 
   if ( verbose ) {
-    hexdump( key.data(), 16, "key" );
+    hexdump( key.data(), key.len(), "key" );
   }
 
   for ( size_t i = 0; i < MESSAGES_PER_SESSION; i++ ) {
@@ -124,6 +124,19 @@ static void test_one_session( void )
     fatal_assert( decrypted.nonce.val() == nonce_int );
     fatal_assert( decrypted.text == plaintext );
 
+    /* the same, in place, in a buffer with room for the nonce and tag */
+    AlignedBuffer buffer( 16 + plaintext.size() + Session::TAILROOM );
+    memcpy( buffer.data() + 16, plaintext.data(), plaintext.size() );
+    const Span datagram = encryption_session.encrypt_in_place(
+      nonce, Span( buffer.data() + 16, plaintext.size(), 16, Session::TAILROOM ) );
+    fatal_assert( std::string( datagram.data, datagram.len ) == ciphertext );
+
+    uint64_t decrypted_nonce_int;
+    const Span text = decryption_session.decrypt_in_place( datagram, decrypted_nonce_int );
+    fatal_assert( decrypted_nonce_int == nonce_int );
+    fatal_assert( text.data == buffer.data() + 16 );
+    fatal_assert( std::string( text.data, text.len ) == plaintext );
+
     nonce_int++;
 
     if ( !( prng.uint8() % 16 ) ) {
@@ -136,15 +149,109 @@ static void test_one_session( void )
   }
 }
 
+/* A batch of datagrams, as the network layer encrypts and decrypts them,
+   matches one at a time; tampered and short ones are rejected alone. */
+static void test_batch( Algorithm algorithm )
+{
+  Base64Key key( algorithm );
+  Session encryption_session( key );
+  Session decryption_session( Base64Key( key.printable_key() ) );
+
+  const size_t n = 1 + prng.uint8() % Session::BATCH_MAX;
+  const size_t room = 16 + MESSAGE_SIZE_MAX + Session::TAILROOM;
+  AlignedBuffer buffer( n * room );
+  Nonce nonces[Session::BATCH_MAX];
+  Span spans[Session::BATCH_MAX];
+  std::string plaintexts[Session::BATCH_MAX];
+  uint64_t nonce_ints[Session::BATCH_MAX];
+
+  for ( size_t i = 0; i < n; i++ ) {
+    nonce_ints[i] = prng.uint64();
+    nonces[i] = Nonce( nonce_ints[i] );
+    plaintexts[i] = random_payload();
+    char* text = buffer.data() + i * room + 16;
+    memcpy( text, plaintexts[i].data(), plaintexts[i].size() );
+    spans[i] = Span( text, plaintexts[i].size(), 16, room - 16 - plaintexts[i].size() );
+  }
+
+  encryption_session.encrypt_batch( n, nonces, spans );
+
+  bool tampered[Session::BATCH_MAX];
+  for ( size_t i = 0; i < n; i++ ) {
+    const std::string ciphertext = encryption_session.encrypt( Message( nonces[i], plaintexts[i] ) );
+    fatal_assert( std::string( spans[i].data, spans[i].len ) == ciphertext );
+
+    tampered[i] = !( prng.uint8() % 4 );
+    if ( tampered[i] ) {
+      if ( prng.uint8() % 2 ) {
+        spans[i].data[prng.uint32() % spans[i].len] ^= 1 << ( prng.uint8() % 8 );
+      } else {
+        spans[i].len = prng.uint8() % ( Session::HEADROOM + Session::TAILROOM );
+      }
+    }
+  }
+
+  uint64_t nonce_vals[Session::BATCH_MAX];
+  bool ok[Session::BATCH_MAX];
+  decryption_session.decrypt_batch( n, spans, nonce_vals, ok );
+  for ( size_t i = 0; i < n; i++ ) {
+    fatal_assert( ok[i] == !tampered[i] );
+    if ( ok[i] ) {
+      fatal_assert( nonce_vals[i] == nonce_ints[i] );
+      fatal_assert( std::string( spans[i].data, spans[i].len ) == plaintexts[i] );
+    }
+  }
+}
+
+/* A block of zeros under an all-zero key and nonce: test case 14 of the
+   GCM specification, and the same for ChaCha20-Poly1305 per RFC 8439. */
+static void test_known_answer( Algorithm algorithm )
+{
+  const char* expected;
+  switch ( algorithm ) {
+    case AES_256_GCM:
+      expected = "cea7403d4d606b6e074ec5d3baf39d18d0d1c8a799996bf0265b98b5d48ab919";
+      break;
+    case CHACHA20_POLY1305:
+      expected = "9f07e7be5551387a98ba977c732d080dc34a88047320f52aa2c6683ef8084d2f";
+      break;
+    default:
+      return;
+  }
+
+  Session session( Base64Key( std::string( algorithm_name( algorithm ) ) + ":" + std::string( 43, 'A' ) ) );
+  const std::string ciphertext = session.encrypt( Message( Nonce( 0 ), std::string( 16, '\0' ) ) );
+
+  std::string hex;
+  for ( size_t i = 8; i < ciphertext.size(); i++ ) { /* after the sent part of the nonce */
+    char byte[3];
+    snprintf( byte, sizeof byte, "%02x", static_cast<unsigned char>( ciphertext[i] ) );
+    hex += byte;
+  }
+  if ( verbose ) {
+    printf( "%s: %s\n", algorithm_name( algorithm ), hex.c_str() );
+  }
+  fatal_assert( hex == expected );
+}
+
 int main( int argc, char* argv[] )
 {
   if ( argc >= 2 && strcmp( argv[1], "-v" ) == 0 ) {
     verbose = true;
   }
 
-  for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+  for ( int a = AES_128_OCB; a <= CHACHA20_POLY1305; a++ ) {
+    const Algorithm algorithm = Algorithm( a );
+    if ( algorithm_from_name( algorithm_name( algorithm ) ) == ALGORITHM_NONE ) {
+      continue; /* not in this build */
+    }
+
     try {
-      test_one_session();
+      for ( size_t i = 0; i < NUM_SESSIONS; i++ ) {
+        test_one_session( algorithm );
+        test_batch( algorithm );
+      }
+      test_known_answer( algorithm );
     } catch ( const CryptoException& e ) {
       fprintf( stderr, "Crypto exception: %s\r\n", e.what() );
       return 1;
@@ -41,6 +41,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <vector>
 
 #include "src/crypto/ae.h"
 #include "src/crypto/crypto.h"
@@ -563,15 +564,169 @@ static void test_iterative( void )
   scrap_ctx( *ctx_buf );
 }
 
+/* The vectors above are all shorter than eight blocks.  Messages up to
+   a few kilobytes, at lengths around and between multiples of eight
+   blocks, take the long paths through ae_encrypt and ae_decrypt. */
+
+static void test_long( void )
+{
+  AlignedBuffer key( KEY_LEN );
+  for ( size_t i = 0; i < KEY_LEN; i++ ) {
+    ( (uint8_t*)key.data() )[i] = i;
+  }
+
+  AlignedPointer ctx_buf( get_ctx( key ) );
+  ae_ctx* ctx = (ae_ctx*)ctx_buf->data();
+
+  AlignedBuffer nonce( NONCE_LEN );
+  memset( nonce.data(), 0, NONCE_LEN );
+
+  const size_t max_len = 4096;
+  AlignedBuffer message( max_len );
+  for ( size_t i = 0; i < max_len; i++ ) {
+    ( (uint8_t*)message.data() )[i] = i * 7 + ( i >> 8 );
+  }
+
+  /* The loop below fills this buffer with each ciphertext and tag. */
+  AlignedBuffer accumulator( 188691 );
+  uint8_t* acc = (uint8_t*)accumulator.data();
+
+  AlignedBuffer out( max_len + TAG_LEN );
+  AlignedBuffer back( max_len );
+  for ( size_t len = 0; len <= max_len; len += ( len < 300 ) ? 1 : 61 ) {
+    ( (uint8_t*)nonce.data() )[10] = len >> 8;
+    ( (uint8_t*)nonce.data() )[11] = len;
+
+    /* The start of the message doubles as the associated data. */
+    fatal_assert( (int)( len + TAG_LEN )
+                  == ae_encrypt(
+                    ctx, nonce.data(), message.data(), len, message.data(), len - len / 2, out.data(), NULL,
+                    AE_FINALIZE ) );
+    fatal_assert( (int)len
+                  == ae_decrypt( ctx,
+                                 nonce.data(),
+                                 out.data(),
+                                 len + TAG_LEN,
+                                 message.data(),
+                                 len - len / 2,
+                                 back.data(),
+                                 NULL,
+                                 AE_FINALIZE ) );
+    fatal_assert( !memcmp( back.data(), message.data(), len ) );
+
+    fatal_assert( acc + len + TAG_LEN <= (uint8_t*)accumulator.data() + accumulator.len() );
+    memcpy( acc, out.data(), len + TAG_LEN );
+    acc += len + TAG_LEN;
+  }
+  fatal_assert( acc == (uint8_t*)accumulator.data() + accumulator.len() );
+
+  /* The tag over all of them, as OpenSSL's own OCB computes it */
+  AlignedBuffer tag( TAG_LEN );
+  memset( nonce.data(), 0, NONCE_LEN );
+  fatal_assert(
+    0 <= ae_encrypt(
+      ctx, nonce.data(), NULL, 0, accumulator.data(), accumulator.len(), tag.data(), NULL, AE_FINALIZE ) );
+  AlignedBuffer correct( TAG_LEN, "\x34\xB5\xBE\xBF\x30\x05\xC6\xE1\xF2\xB8\xDA\x38\xA5\x73\xA4\x8E" );
+  fatal_assert( equal( tag, correct ) );
+
+  if ( verbose ) {
+    printf( "long PASSED\n\n" );
+  }
+  scrap_ctx( *ctx_buf );
+}
+
+/* Batches agree with one message at a time, across more messages than
+   are interleaved in one pass, and reject what has been tampered with. */
+static void test_batch( void )
+{
+  AlignedBuffer key( KEY_LEN );
+  for ( size_t i = 0; i < KEY_LEN; i++ ) {
+    ( (uint8_t*)key.data() )[i] = i * 3;
+  }
+
+  AlignedPointer ctx_buf( get_ctx( key ) );
+  ae_ctx* ctx = (ae_ctx*)ctx_buf->data();
+
+  const int count = 40;
+  const int max_len = 2048;
+  char nonce_bytes[1 + count * NONCE_LEN]; /* deliberately unaligned */
+  const void* nonces[count];
+  std::vector<AlignedPointer> texts;
+  void* text_ptrs[count];
+  int lens[count], results[count];
+
+  AlignedBuffer single( max_len + TAG_LEN );
+  AlignedBuffer message( max_len );
+  for ( int i = 0; i < count; i++ ) {
+    lens[i] = ( i * i * 37 + i ) % max_len;
+    memset( nonce_bytes + 1 + i * NONCE_LEN, i, NONCE_LEN );
+    nonces[i] = nonce_bytes + 1 + i * NONCE_LEN;
+    texts.push_back( AlignedPointer( new AlignedBuffer( max_len + TAG_LEN ) ) );
+    text_ptrs[i] = texts.back()->data();
+    for ( int j = 0; j < lens[i]; j++ ) {
+      ( (uint8_t*)text_ptrs[i] )[j] = i + j * 5;
+    }
+  }
+
+  fatal_assert( AE_SUCCESS == ae_encrypt_batch( ctx, count, nonces, text_ptrs, lens, results ) );
+  for ( int i = 0; i < count; i++ ) {
+    for ( int j = 0; j < lens[i]; j++ ) {
+      ( (uint8_t*)message.data() )[j] = i + j * 5;
+    }
+    memcpy( single.data(), nonces[i], NONCE_LEN );
+    fatal_assert( lens[i] + TAG_LEN
+                  == ae_encrypt(
+                    ctx, single.data(), message.data(), lens[i], NULL, 0, single.data(), NULL, AE_FINALIZE ) );
+    fatal_assert( results[i] == lens[i] + TAG_LEN );
+    fatal_assert( !memcmp( text_ptrs[i], single.data(), results[i] ) );
+
+    lens[i] = results[i];
+    if ( i % 5 == 3 ) {
+      ( (uint8_t*)text_ptrs[i] )[i % lens[i]] ^= 0x40;
+    }
+  }
+  lens[count - 1] = TAG_LEN - 1;
+
+  fatal_assert( AE_SUCCESS == ae_decrypt_batch( ctx, count, nonces, text_ptrs, lens, results ) );
+  for ( int i = 0; i < count; i++ ) {
+    if ( ( i % 5 == 3 ) || ( i == count - 1 ) ) {
+      fatal_assert( results[i] == AE_INVALID );
+      continue;
+    }
+    fatal_assert( results[i] == lens[i] - TAG_LEN );
+    for ( int j = 0; j < results[i]; j++ ) {
+      fatal_assert( ( (uint8_t*)text_ptrs[i] )[j] == (uint8_t)( i + j * 5 ) );
+    }
+  }
+
+  if ( verbose ) {
+    printf( "batch PASSED\n\n" );
+  }
+  scrap_ctx( *ctx_buf );
+}
+
 int main( int argc, char* argv[] )
 {
   if ( argc >= 2 && strcmp( argv[1], "-v" ) == 0 ) {
     verbose = true;
   }
 
+  /* The default, then each AES implementation beneath it, where the
+     processor has them; see AESNI::level(). */
+  const char* impls[] = { NULL, "aesni", "library" };
   try {
-    test_all_vectors();
-    test_iterative();
+    for ( size_t i = 0; i < sizeof impls / sizeof *impls; i++ ) {
+      if ( impls[i] ) {
+        fatal_assert( 0 == setenv( "MOSH_AES_IMPL", impls[i], 1 ) );
+      }
+      if ( verbose ) {
+        printf( "AES implementation: %s\n\n", impls[i] ? impls[i] : "default" );
+      }
+      test_all_vectors();
+      test_iterative();
+      test_long();
+      test_batch();
+    }
   } catch ( const std::exception& e ) {
     fprintf( stderr, "Error: %s\r\n", e.what() );
     return 1;
@@ -0,0 +1,123 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+/* Tests the PRNG: its ChaCha20 against RFC 8439, and that its output
+   does not repeat across refills, reseeds or fork(). */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "src/crypto/prng.h"
+#include "src/util/fatal_assert.h"
+
+/* RFC 8439, section 2.3.2 */
+static void test_block( void )
+{
+  uint32_t key[8];
+  for ( int i = 0; i < 8; i++ ) {
+    key[i] = ( 4 * i ) | ( ( 4 * i + 1 ) << 8 ) | ( ( 4 * i + 2 ) << 16 ) | ( ( 4 * i + 3 ) << 24 );
+  }
+  const uint32_t nonce[3] = { 0x09000000, 0x4a000000, 0x00000000 };
+  unsigned char out[64];
+  chacha20_block( key, 1, nonce, out );
+
+  const char expected[] = "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                          "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e";
+  std::string hex;
+  for ( size_t i = 0; i < sizeof out; i++ ) {
+    char byte[3];
+    snprintf( byte, sizeof byte, "%02x", out[i] );
+    hex += byte;
+  }
+  fatal_assert( hex == expected );
+}
+
+/* Many more 8-byte draws than fit in one buffer, past a reseed */
+static void test_stream( void )
+{
+  PRNG prng;
+  std::set<uint64_t> seen;
+  const size_t draws = ( 3 << 20 ) / 8;
+  for ( size_t i = 0; i < draws; i++ ) {
+    fatal_assert( seen.insert( prng.uint64() ).second );
+  }
+
+  /* and a fill larger than the buffer */
+  std::string big( 5000, '\0' );
+  prng.fill( &big[0], big.size() );
+  fatal_assert( big.find( std::string( 16, '\0' ) ) == std::string::npos );
+}
+
+/* A child after fork() does not repeat what its parent draws next */
+static void test_fork( void )
+{
+  PRNG prng;
+  prng.uint64(); /* so that there is a buffer to inherit */
+
+  int fds[2];
+  fatal_assert( 0 == pipe( fds ) );
+  const pid_t child = fork();
+  fatal_assert( child >= 0 );
+  if ( child == 0 ) {
+    const uint64_t x = prng.uint64();
+    _exit( write( fds[1], &x, sizeof x ) == sizeof x ? 0 : 1 );
+  }
+
+  const uint64_t mine = prng.uint64();
+  uint64_t theirs;
+  fatal_assert( read( fds[0], &theirs, sizeof theirs ) == sizeof theirs );
+  int status;
+  fatal_assert( waitpid( child, &status, 0 ) == child );
+  fatal_assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+  fatal_assert( mine != theirs );
+  close( fds[0] );
+  close( fds[1] );
+}
+
+int main( void )
+{
+  try {
+    test_block();
+    test_stream();
+    test_fork();
+  } catch ( const CryptoException& e ) {
+    fprintf( stderr, "Crypto exception: %s\n", e.what() );
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,197 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+
+/* Tests that structured screen deltas reproduce the server's
+   framebuffer exactly on the client, with and without the journal,
+   and that the digest catches a client that has drifted. */
+
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "src/statesync/completeterminal.h"
+#include "src/util/fatal_assert.h"
+
+using namespace Terminal;
+
+/* Random text (including wide and combining characters), colors,
+   cursor motion, scrolling, erasure, modes and titles. */
+static std::string random_output( int width, int height, size_t len )
+{
+  std::string ret;
+  char tmp[64];
+  while ( ret.size() < len ) {
+    switch ( rand() % 20 ) {
+      case 0:
+        snprintf( tmp, sizeof tmp, "\033[%d;%dm", 30 + rand() % 8, 40 + rand() % 8 );
+        ret += tmp;
+        break;
+      case 1:
+        snprintf( tmp,
+                  sizeof tmp,
+                  "\033[0;%d;38;2;%d;%d;%dm",
+                  1 + rand() % 9,
+                  rand() % 256,
+                  rand() % 256,
+                  rand() % 256 );
+        ret += tmp;
+        break;
+      case 2:
+        snprintf( tmp, sizeof tmp, "\033[%d;%dH", 1 + rand() % height, 1 + rand() % width );
+        ret += tmp;
+        break;
+      case 3:
+        if ( rand() % 4 ) {
+          ret += "\r\n";
+        } else {
+          int top = 1 + rand() % height;
+          snprintf( tmp, sizeof tmp, "\033[%d;%dr", top, top + rand() % ( height + 1 - top ) );
+          ret += tmp;
+        }
+        break;
+      case 4:
+        ret += ( rand() % 2 ) ? "\033[K" : "\033[1J";
+        break;
+      case 5:
+        snprintf( tmp, sizeof tmp, "\033[%d%c", 1 + rand() % 5, "LMST@P"[rand() % 6] );
+        ret += tmp;
+        break;
+      case 6:
+        ret += "\xe4\xb8\xad\xe6\x96\x87"; /* wide */
+        break;
+      case 7:
+        ret += "e\xcc\x81\xcc\x82"; /* combining */
+        break;
+      case 8:
+        snprintf( tmp, sizeof tmp, "\033]0;title %d\007", rand() % 100 );
+        ret += tmp;
+        break;
+      case 9:
+        ret += ( rand() % 2 ) ? "\033[?25l\033[?1000h\033[?2004h" : "\033[?25h\033[?1000l\033[?1006h";
+        break;
+      case 10:
+        ret += "\007";
+        break;
+      default:
+        for ( int i = rand() % 80; i > 0; i-- ) {
+          ret += static_cast<char>( ' ' + rand() % 95 );
+        }
+        break;
+    }
+  }
+  return ret;
+}
+
+static void check_same( const Complete& server, const Complete& client )
+{
+  const Framebuffer& s = server.get_fb();
+  const Framebuffer& c = client.get_fb();
+  fatal_assert( s.ds == c.ds );
+  fatal_assert( s.get_window_title() == c.get_window_title() );
+  fatal_assert( s.get_icon_name() == c.get_icon_name() );
+  for ( int y = 0; y < s.ds.get_height(); y++ ) {
+    fatal_assert( s.get_row( y )->cells == c.get_row( y )->cells );
+  }
+}
+
+static void test_size( int width, int height, bool journal )
+{
+  Complete server( width, height );
+  Complete client( width, height );
+  server.set_screen_delta( true );
+  server.set_digest( true );
+  if ( journal ) {
+    server.enable_journal();
+  }
+
+  Complete last( server );
+  for ( int i = 0; i < 50; i++ ) {
+    server.act( random_output( width, height, rand() % ( width * height ) ) );
+    if ( i % 10 == 9 ) {
+      width += rand() % 21 - 10;
+      height += rand() % 11 - 5;
+      server.act( Parser::Resize( width, height ) );
+    }
+    /* sometimes let changes pile up over several frames */
+    if ( rand() % 3 ) {
+      fatal_assert( client.apply_string( server.diff_from( last ) ) );
+      check_same( server, client );
+      last = server;
+    }
+  }
+}
+
+/* A client whose frame has drifted notices, and a full diff repairs it. */
+static void test_resync( int width, int height )
+{
+  Complete server( width, height );
+  Complete client( width, height );
+  server.set_screen_delta( true );
+  server.set_digest( true );
+
+  for ( int i = 0; i < 20; i++ ) {
+    Complete last( server );
+    server.act( random_output( width, height, 1 + rand() % ( width * height ) ) );
+
+    Complete drifted( client );
+    drifted.act( random_output( width, height, 1 + rand() % 20 ) );
+    drifted.act( "\033]52;c;ZHJpZnRlZA==\007" ); /* never sent by this server */
+    fatal_assert( !drifted.apply_string( server.diff_from( last ) ) );
+
+    Complete repaired( drifted );
+    fatal_assert( repaired.apply_string( server.resync_diff( last ) ) );
+    check_same( server, repaired );
+
+    fatal_assert( client.apply_string( server.diff_from( last ) ) );
+    check_same( server, client );
+  }
+}
+
+int main()
+{
+  /* wide and combining characters need a UTF-8 locale */
+  if ( !setlocale( LC_CTYPE, "C.UTF-8" ) && !setlocale( LC_CTYPE, "en_US.UTF-8" ) ) {
+    fprintf( stderr, "No UTF-8 locale, skipping.\n" );
+    return 77;
+  }
+  srand( 1 );
+
+  test_size( 80, 24, false );
+  test_size( 200, 60, false );
+  test_size( 80, 24, true );
+  test_size( 200, 60, true );
+  test_resync( 80, 24 );
+
+  return 0;
+}